@@ -0,0 +1,79 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <cstddef>
+#include <cstdlib>
+#include <stdint.h>
+
+
+// Growable array of trivially copyable values whose storage is aligned on 64 bytes
+// (cache lines, AVX-512 registers). The storage is only reallocated when the buffer
+// grows beyond its capacity, so that a buffer can be reused across calls without
+// allocations ; the content is not preserved by a reallocation.
+template<typename T>
+class AlignedBuffer {
+public:
+	static const size_t ALIGNMENT = 64;
+
+	AlignedBuffer() : raw(NULL), ptr(NULL), count(0), capacity(0) {}
+	AlignedBuffer(AlignedBuffer &&other) : raw(other.raw), ptr(other.ptr), count(other.count), capacity(other.capacity) {
+		other.raw = NULL;
+		other.ptr = NULL;
+		other.count = other.capacity = 0;
+	}
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+	~AlignedBuffer() {
+		free(raw);
+	}
+
+	// sets the number of values to n (uninitialized when the storage grows)
+	void resize(size_t n) {
+		if (n > capacity) {
+			free(raw);
+			raw = malloc(n * sizeof(T) + ALIGNMENT);
+			ptr = (T*)(((uintptr_t)raw + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+			capacity = n;
+		}
+		count = n;
+	}
+
+	T* data() { return ptr; }
+	const T* data() const { return ptr; }
+	size_t size() const { return count; }
+	T& operator[](size_t i) { return ptr[i]; }
+	const T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+	void *raw;
+	T *ptr;
+	size_t count, capacity;
+};
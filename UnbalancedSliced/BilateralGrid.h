@@ -0,0 +1,194 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ThreadPool.h"
+
+
+// Multi-threaded joint bilateral filter of 2D images, using the bilateral grid
+// of S. Paris and F. Durand (ECCV 2006), with the same grid geometry as
+// CImg::blur_bilateral (spatial sampling sigmaS, range sampling sigmaR, padding
+// of 3 cells): pixels are splatted on a downsampled (x, y, guide value) grid,
+// the grid is blurred with a sampled gaussian of unit standard deviation along
+// each axis, and the result is read back by trilinear interpolation.
+// CImg blurs the grid with a recursive (Deriche) approximation of the gaussian,
+// so that the two filters differ slightly.
+class BilateralGrid {
+public:
+
+	// filters the single channel image (width x height) guided by guide, whose values
+	// are expected in [edgeMin, edgeMax] ; image and guide may be the same buffer
+	template<typename T>
+	static void filter(T* image, const T* guide, int width, int height, float sigmaS, float sigmaR, T edgeMin, T edgeMax) {
+		if (width <= 0 || height <= 0 || sigmaS <= 0.0f || edgeMin == edgeMax) return;
+		const float edgeDelta = (float)(edgeMax - edgeMin);
+		const float samplingS = std::max(sigmaS, 1.0f);
+		const float samplingR = std::max(sigmaR, edgeDelta / 256);
+		const float derivedS = sigmaS / samplingS, derivedR = sigmaR / samplingR;
+		const int paddingS = (int)(2 * derivedS) + 1, paddingR = (int)(2 * derivedR) + 1;
+		const int bx = (int)((width - 1) / samplingS + 1 + 2 * paddingS);
+		const int by = (int)((height - 1) / samplingS + 1 + 2 * paddingS);
+		const int br = (int)(edgeDelta / samplingR + 1 + 2 * paddingR);
+		ThreadPool &pool = ThreadPool::instance();
+
+		// (value, weight) pairs, X fastest then Y then R
+		std::vector<float> grid((size_t)bx * by * br * 2, 0.0f);
+		auto cell = [&](int X, int Y, int R) { return (((size_t)R * by + Y) * bx + X) * 2; };
+
+		// splatting: each thread owns a band of Y cells, so that the accumulation
+		// order does not depend on the number of threads
+		pool.parallelFor(by, [&](size_t begin, size_t end) {
+			for (int y = 0; y < height; y++) {
+				const int Y = (int)std::floor(y / samplingS + 0.5f) + paddingS;
+				if (Y < (int)begin || Y >= (int)end) continue;
+				for (int x = 0; x < width; x++) {
+					const size_t p = (size_t)y * width + x;
+					const int X = (int)std::floor(x / samplingS + 0.5f) + paddingS;
+					const int R = (int)std::floor(((float)guide[p] - (float)edgeMin) / samplingR + 0.5f) + paddingR;
+					float *g = &grid[cell(X, Y, R)];
+					g[0] += (float)image[p];
+					g[1] += 1.0f;
+				}
+			}
+		}, 1);
+
+		// separable gaussian blur: clamped borders in space, zero borders in range
+		blurAxis(grid, bx, by, br, 0, derivedS, true);
+		blurAxis(grid, bx, by, br, 1, derivedS, true);
+		blurAxis(grid, bx, by, br, 2, derivedR, false);
+
+		// slicing (the padding keeps the 8 nodes of every pixel inside the grid)
+		std::vector<int> cellX(width);
+		std::vector<float> fracX(width);
+		for (int x = 0; x < width; x++) {
+			const float c = x / samplingS + paddingS;
+			cellX[x] = (int)c;
+			fracX[x] = c - cellX[x];
+		}
+		const size_t strideY = (size_t)bx * 2, strideR = (size_t)bx * by * 2;
+		pool.parallelFor(height, [&](size_t begin, size_t end) {
+			for (size_t y = begin; y < end; y++) {
+				const float cy = y / samplingS + paddingS;
+				const int Y = (int)cy;
+				const float ty = cy - Y;
+				for (int x = 0; x < width; x++) {
+					const size_t p = y * width + x;
+					const float cr = ((float)guide[p] - (float)edgeMin) / samplingR + paddingR;
+					const int R = (int)cr;
+					const float tr = cr - R;
+					// (value, weight) of the nodes X and X+1 are contiguous
+					const float *g = &grid[cell(cellX[x], Y, R)];
+					const float w00 = (1.0f - ty) * (1.0f - tr), w10 = ty * (1.0f - tr), w01 = (1.0f - ty) * tr, w11 = ty * tr;
+					float q[4];
+					for (int k = 0; k < 4; k++)
+						q[k] = w00 * g[k] + w10 * g[strideY + k] + w01 * g[strideR + k] + w11 * g[strideY + strideR + k];
+					const float tx = fracX[x];
+					image[p] = (T)(((1.0f - tx) * q[0] + tx * q[2]) / ((1.0f - tx) * q[1] + tx * q[3]));
+				}
+			}
+		}, 16);
+	}
+
+	// filters each channel of a planar image guided by itself, the range of the grid
+	// being the range of the whole image (as CImg's img.blur_bilateral(img, sigmaS, sigmaR))
+	template<typename T>
+	static void filterPlanar(T* image, int width, int height, int nbChannels, float sigmaS, float sigmaR) {
+		const size_t n = (size_t)width * height * nbChannels;
+		if (n == 0) return;
+		const T edgeMin = *std::min_element(image, image + n);
+		const T edgeMax = *std::max_element(image, image + n);
+		for (int c = 0; c < nbChannels; c++) {
+			T *channel = image + (size_t)c * width * height;
+			filter(channel, channel, width, height, sigmaS, sigmaR, edgeMin, edgeMax);
+		}
+	}
+
+private:
+
+	// blurs the (value, weight) grid along one axis with a gaussian truncated at 3 sigma
+	// the grid is seen as [outer][len][inner] floats, len being the blurred axis ; the
+	// filter is applied to blocks of consecutive inner values at once (vectorized loop)
+	static void blurAxis(std::vector<float> &grid, int bx, int by, int br, int axis, float sigma, bool clampBorders) {
+		if (sigma <= 0.0f) return;
+		const int radius = std::max(1, (int)std::ceil(3 * sigma));
+		std::vector<float> kernel(2 * radius + 1);
+		float sum = 0.0f;
+		for (int k = -radius; k <= radius; k++)
+			sum += kernel[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+		for (int k = 0; k <= 2 * radius; k++) kernel[k] /= sum;
+
+		const int dims[3] = { bx, by, br };
+		const int len = dims[axis];
+		size_t inner = 2, outer = 1;
+		for (int a = 0; a < axis; a++) inner *= dims[a];
+		for (int a = axis + 1; a < 3; a++) outer *= dims[a];
+		// along X, the two values of a node are blurred as a pair of interleaved lines
+		const size_t block = (axis == 0) ? 2 : std::min(inner, (size_t)256);
+		const size_t nbBlocks = (inner + block - 1) / block;
+
+		ThreadPool::instance().parallelFor(outer * nbBlocks, [&](size_t begin, size_t end) {
+			std::vector<float> tmp(len * block), res(len * block);
+			for (size_t l = begin; l < end; l++) {
+				const size_t o = l / nbBlocks, i0 = (l % nbBlocks) * block;
+				const size_t bs = std::min(block, inner - i0);
+				float *base = &grid[o * len * inner + i0];
+				for (int i = 0; i < len; i++)
+					std::copy(base + i * inner, base + i * inner + bs, &tmp[i * bs]);
+				// interior: the line is contiguous in tmp, taps are bs floats apart
+				const int first = std::min(radius, len), last = std::max(first, len - radius);
+				for (size_t f = first * bs; f < last * bs; f++) {
+					float v = 0.0f;
+					for (int k = -radius; k <= radius; k++)
+						v += kernel[k + radius] * tmp[f + k * bs];
+					res[f] = v;
+				}
+				// borders
+				for (int i = 0; i < len; i++) {
+					if (i == first) i = last;
+					if (i >= len) break;
+					std::fill(&res[i * bs], &res[i * bs] + bs, 0.0f);
+					for (int k = -radius; k <= radius; k++) {
+						int j = i + k;
+						if (j < 0 || j >= len) {
+							if (!clampBorders) continue;
+							j = std::min(len - 1, std::max(0, j));
+						}
+						for (size_t e = 0; e < bs; e++)
+							res[i * bs + e] += kernel[k + radius] * tmp[j * bs + e];
+					}
+				}
+				for (int i = 0; i < len; i++)
+					std::copy(&res[i * bs], &res[i * bs] + bs, base + i * inner);
+			}
+		}, 4);
+	}
+};
@@ -0,0 +1,168 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ThreadPool.h"
+
+
+// Smooth displacement field over the RGB cube, stored on a regular lattice of
+// resolution^3 nodes spanning [0, maxValue]^3.
+// The lattice is fitted from scattered (color, displacement) samples by
+// trilinear splatting followed by a normalization (nodes without samples take
+// the average of their fitted neighbors), and evaluated by trilinear interpolation.
+// It is used to lift a transport computed on a few colors (e.g. a downsampled
+// image) to any other set of colors without solving the transport again.
+class ColorLattice {
+public:
+
+	ColorLattice(int resolution = 33, float maxValue = 255.0f) : resolution(std::max(2, resolution)), maxValue(maxValue) {
+		values.assign((size_t)this->resolution * this->resolution * this->resolution * 3, 0.0f);
+	}
+
+	// fits the lattice from n samples: colors and displacements are planar (3 arrays of n values)
+	void fit(const float* const* colors, const float* const* disp, size_t n) {
+		const size_t nbNodes = (size_t)resolution * resolution * resolution;
+		// fixed number of chunks so that the sums do not depend on the number of threads
+		const size_t nbChunks = std::max((size_t)1, std::min((size_t)8, n / 65536));
+		const size_t chunk = (n + nbChunks - 1) / nbChunks;
+		std::vector<std::vector<double> > sums(nbChunks);
+
+		ThreadPool::instance().parallelChunks(nbChunks, [&](size_t c) {
+			std::vector<double> &s = sums[c];
+			s.assign(nbNodes * 4, 0.0);
+			const size_t begin = std::min(n, c * chunk), end = std::min(n, begin + chunk);
+			for (size_t i = begin; i < end; i++) {
+				size_t nodes[8];
+				float w[8];
+				cell(colors[0][i], colors[1][i], colors[2][i], nodes, w);
+				for (int v = 0; v < 8; v++) {
+					double *node = &s[nodes[v] * 4];
+					node[0] += w[v] * disp[0][i];
+					node[1] += w[v] * disp[1][i];
+					node[2] += w[v] * disp[2][i];
+					node[3] += w[v];
+				}
+			}
+		});
+		for (size_t c = 1; c < nbChunks; c++)
+			for (size_t j = 0; j < nbNodes * 4; j++)
+				sums[0][j] += sums[c][j];
+
+		// normalization, weights below the threshold are treated as empty nodes
+		std::vector<double> &s = sums[0];
+		std::vector<char> filled(nbNodes, 0);
+		size_t nbFilled = 0;
+		for (size_t j = 0; j < nbNodes; j++) {
+			if (s[j * 4 + 3] > 1e-6) {
+				for (int k = 0; k < 3; k++)
+					values[j * 3 + k] = (float)(s[j * 4 + k] / s[j * 4 + 3]);
+				filled[j] = 1;
+				nbFilled++;
+			}
+		}
+		if (nbFilled == 0) {
+			std::fill(values.begin(), values.end(), 0.0f);
+			return;
+		}
+
+		// empty nodes are filled layer by layer from their 6-neighbors
+		std::vector<char> next(filled);
+		while (nbFilled < nbNodes) {
+			for (int r = 0; r < resolution; r++)
+				for (int g = 0; g < resolution; g++)
+					for (int b = 0; b < resolution; b++) {
+						const size_t j = index(r, g, b);
+						if (filled[j]) continue;
+						const int nb[6][3] = { {r - 1, g, b}, {r + 1, g, b}, {r, g - 1, b}, {r, g + 1, b}, {r, g, b - 1}, {r, g, b + 1} };
+						float acc[3] = { 0.0f, 0.0f, 0.0f };
+						int count = 0;
+						for (int v = 0; v < 6; v++) {
+							if (nb[v][0] < 0 || nb[v][1] < 0 || nb[v][2] < 0 || nb[v][0] >= resolution || nb[v][1] >= resolution || nb[v][2] >= resolution) continue;
+							const size_t q = index(nb[v][0], nb[v][1], nb[v][2]);
+							if (!filled[q]) continue;
+							for (int k = 0; k < 3; k++) acc[k] += values[q * 3 + k];
+							count++;
+						}
+						if (count == 0) continue;
+						for (int k = 0; k < 3; k++) values[j * 3 + k] = acc[k] / count;
+						next[j] = 1;
+						nbFilled++;
+					}
+			filled = next;
+		}
+	}
+
+	// adds the interpolated displacement to n planar colors (3 arrays of n values)
+	void apply(float* const* colors, size_t n) const {
+		ThreadPool::instance().parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				size_t nodes[8];
+				float w[8];
+				cell(colors[0][i], colors[1][i], colors[2][i], nodes, w);
+				float d[3] = { 0.0f, 0.0f, 0.0f };
+				for (int v = 0; v < 8; v++)
+					for (int k = 0; k < 3; k++)
+						d[k] += w[v] * values[nodes[v] * 3 + k];
+				for (int k = 0; k < 3; k++)
+					colors[k][i] += d[k];
+			}
+		});
+	}
+
+	int resolution;
+	float maxValue;
+	std::vector<float> values; // 3 displacement values per node, node (r,g,b) at index (r*resolution + g)*resolution + b
+
+private:
+
+	size_t index(int r, int g, int b) const {
+		return ((size_t)r * resolution + g) * resolution + b;
+	}
+
+	// the 8 nodes of the cell containing the color and their trilinear weights
+	void cell(float r, float g, float b, size_t* nodes, float* w) const {
+		const float scale = (resolution - 1) / maxValue;
+		const float c[3] = { r * scale, g * scale, b * scale };
+		int i0[3];
+		float t[3];
+		for (int k = 0; k < 3; k++) {
+			float x = std::min((float)(resolution - 1), std::max(0.0f, c[k]));
+			i0[k] = std::min(resolution - 2, (int)x);
+			t[k] = x - i0[k];
+		}
+		for (int v = 0; v < 8; v++) {
+			const int dr = (v >> 2) & 1, dg = (v >> 1) & 1, db = v & 1;
+			nodes[v] = index(i0[0] + dr, i0[1] + dg, i0[2] + db);
+			w[v] = (dr ? t[0] : 1.0f - t[0]) * (dg ? t[1] : 1.0f - t[1]) * (db ? t[2] : 1.0f - t[2]);
+		}
+	}
+};
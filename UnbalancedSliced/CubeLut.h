@@ -0,0 +1,209 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "ThreadPool.h"
+#include "ColorLattice.h"
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#else
+  #include <immintrin.h>
+#endif
+
+
+// 3D color look-up table, read from / written to the Adobe .cube format.
+// Values are stored in the [0,1] domain, padded to 4 floats per node so that
+// the interpolation of the three channels is a single SSE operation.
+// Node (r,g,b) is at index (b*size + g)*size + r (red varies fastest, as in the file).
+class CubeLut {
+public:
+
+	enum Interpolation { TRILINEAR, TETRAHEDRAL };
+
+	CubeLut(int size = 33) {
+		resize(size);
+	}
+
+	void resize(int s) {
+		size = std::max(2, s);
+		table.assign((size_t)size * size * size * 4, 0.0f);
+	}
+
+	float* node(int r, int g, int b) {
+		return &table[(((size_t)b * size + g) * size + r) * 4];
+	}
+	const float* node(int r, int g, int b) const {
+		return &table[(((size_t)b * size + g) * size + r) * 4];
+	}
+
+	// LUT of the mapping c -> c + displacement(c) on 8-bit colors, the displacement
+	// being given by a ColorLattice ; the lattice nodes must match the LUT nodes
+	void fromLattice(const ColorLattice &lattice) {
+		resize(lattice.resolution);
+		for (int r = 0; r < size; r++)
+			for (int g = 0; g < size; g++)
+				for (int b = 0; b < size; b++) {
+					const float *d = &lattice.values[(((size_t)r * size + g) * size + b) * 3];
+					const int c[3] = { r, g, b };
+					float *n = node(r, g, b);
+					for (int k = 0; k < 3; k++) {
+						float v = (c[k] * lattice.maxValue / (size - 1) + d[k]) / lattice.maxValue;
+						n[k] = std::min(1.0f, std::max(0.0f, v));
+					}
+				}
+	}
+
+	// returns false on I/O error
+	bool save(const std::string &filename, const std::string &title = "colorTransfer") const {
+		std::ofstream ofs(filename);
+		if (!ofs) return false;
+		ofs << "TITLE \"" << title << "\"\n";
+		ofs << "LUT_3D_SIZE " << size << "\n";
+		ofs << "DOMAIN_MIN 0.0 0.0 0.0\nDOMAIN_MAX 1.0 1.0 1.0\n";
+		ofs.precision(6);
+		ofs << std::fixed;
+		for (size_t i = 0; i < table.size(); i += 4)
+			ofs << table[i] << " " << table[i + 1] << " " << table[i + 2] << "\n";
+		return (bool)ofs;
+	}
+
+	// returns false on I/O error or unsupported content (1D LUT, custom domain)
+	bool load(const std::string &filename) {
+		std::ifstream ifs(filename);
+		if (!ifs) return false;
+		std::string line;
+		size_t count = 0;
+		bool sized = false;
+		while (std::getline(ifs, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream iss(line);
+			std::string key;
+			iss >> key;
+			if (key == "TITLE") continue;
+			if (key == "LUT_1D_SIZE") return false;
+			if (key == "LUT_3D_SIZE") {
+				int s = 0;
+				iss >> s;
+				if (s < 2) return false;
+				resize(s);
+				sized = true;
+				continue;
+			}
+			if (key == "DOMAIN_MIN" || key == "DOMAIN_MAX") {
+				float a, b, c;
+				iss >> a >> b >> c;
+				const float expected = (key == "DOMAIN_MIN") ? 0.0f : 1.0f;
+				if (a != expected || b != expected || c != expected) return false;
+				continue;
+			}
+			if (!sized || count * 4 >= table.size()) return false;
+			std::istringstream values(line);
+			if (!(values >> table[count * 4] >> table[count * 4 + 1] >> table[count * 4 + 2])) return false;
+			count++;
+		}
+		return sized && count * 4 == table.size();
+	}
+
+	// applies the LUT to n interleaved 8-bit pixels with nbChannels channels (>= 3, extra channels are copied)
+	void apply(const unsigned char *in, unsigned char *out, size_t n, int nbChannels, Interpolation interpolation = TETRAHEDRAL) const {
+		// lattice cell and fractional coordinate of each 8-bit value
+		int cell[256];
+		float frac[256];
+		for (int v = 0; v < 256; v++) {
+			float x = v * (size - 1) / 255.0f;
+			cell[v] = std::min(size - 2, (int)x);
+			frac[v] = x - cell[v];
+		}
+		const size_t strideG = (size_t)size * 4, strideB = (size_t)size * size * 4;
+
+		ThreadPool::instance().parallelFor(n, [&](size_t begin, size_t end) {
+			alignas(16) float res[4];
+			for (size_t i = begin; i < end; i++) {
+				const unsigned char *p = in + i * nbChannels;
+				const float fr = frac[p[0]], fg = frac[p[1]], fb = frac[p[2]];
+				const float *c000 = &table[(((size_t)cell[p[2]] * size + cell[p[1]]) * size + cell[p[0]]) * 4];
+				__m128 v;
+				if (interpolation == TRILINEAR) {
+					const __m128 wr = _mm_set1_ps(fr), wg = _mm_set1_ps(fg), wb = _mm_set1_ps(fb);
+					__m128 c00 = lerp(_mm_loadu_ps(c000), _mm_loadu_ps(c000 + 4), wr);
+					__m128 c10 = lerp(_mm_loadu_ps(c000 + strideG), _mm_loadu_ps(c000 + strideG + 4), wr);
+					__m128 c01 = lerp(_mm_loadu_ps(c000 + strideB), _mm_loadu_ps(c000 + strideB + 4), wr);
+					__m128 c11 = lerp(_mm_loadu_ps(c000 + strideB + strideG), _mm_loadu_ps(c000 + strideB + strideG + 4), wr);
+					v = lerp(lerp(c00, c10, wg), lerp(c01, c11, wg), wb);
+				}
+				else {
+					// the cell is split in 6 tetrahedra along its main diagonal,
+					// the vertices are visited from c000 to c111 by decreasing fraction
+					const size_t sr = 4;
+					size_t s1, s2;
+					float f1, f2, f3;
+					if (fr >= fg) {
+						if (fg >= fb)      { s1 = sr;      s2 = sr + strideG;      f1 = fr; f2 = fg; f3 = fb; }
+						else if (fr >= fb) { s1 = sr;      s2 = sr + strideB;      f1 = fr; f2 = fb; f3 = fg; }
+						else               { s1 = strideB; s2 = sr + strideB;      f1 = fb; f2 = fr; f3 = fg; }
+					}
+					else {
+						if (fb >= fg)      { s1 = strideB; s2 = strideG + strideB; f1 = fb; f2 = fg; f3 = fr; }
+						else if (fb >= fr) { s1 = strideG; s2 = strideG + strideB; f1 = fg; f2 = fb; f3 = fr; }
+						else               { s1 = strideG; s2 = sr + strideG;      f1 = fg; f2 = fr; f3 = fb; }
+					}
+					const __m128 a = _mm_loadu_ps(c000), b = _mm_loadu_ps(c000 + s1), c = _mm_loadu_ps(c000 + s2);
+					const __m128 d = _mm_loadu_ps(c000 + sr + strideG + strideB);
+					v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(1.0f - f1), a), _mm_mul_ps(_mm_set1_ps(f1 - f2), b)),
+					               _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f2 - f3), c), _mm_mul_ps(_mm_set1_ps(f3), d)));
+				}
+				// [0,1] -> [0,255] with rounding and clamping
+				v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+				v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+				_mm_store_ps(res, v);
+				unsigned char *q = out + i * nbChannels;
+				q[0] = (unsigned char)res[0];
+				q[1] = (unsigned char)res[1];
+				q[2] = (unsigned char)res[2];
+				for (int k = 3; k < nbChannels; k++)
+					q[k] = p[k];
+			}
+		});
+	}
+
+	int size;
+	std::vector<float> table;
+
+private:
+
+	static __m128 lerp(__m128 a, __m128 b, __m128 t) {
+		return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+	}
+};
@@ -0,0 +1,263 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers:
+// as easy as 1, 2, 3", SC 2011): a block of 4 random words is a pure function of
+// a 128-bit counter and a 64-bit key, so that any sample can be drawn independently
+// of the others (in any order, on any thread).
+struct Philox4x32 {
+	static void block(const uint32_t counter[4], uint64_t key, uint32_t out[4]) {
+		uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int round = 0; round < 10; round++) {
+			const uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+			const uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+			c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+			c1 = (uint32_t)p1;
+			c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+			c3 = (uint32_t)p0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+	}
+
+	// uniform sample in (0, 1) (never 0 nor 1)
+	static double uniform(uint32_t x) {
+		return (x + 0.5) / 4294967296.0;
+	}
+};
+
+
+// k-th random unit direction in dimension dim for a given seed: normalized gaussian
+// samples (Box-Muller transform of the Philox blocks of counter (k, j)), computed in
+// double precision. The direction only depends on (seed, k).
+template<typename T>
+void randomDirection(uint64_t seed, uint64_t k, int dim, T* dir) {
+	std::vector<double> gauss((dim + 3) & ~3);
+	double norm = 0.0;
+	for (int i = 0; i < dim; i += 4) {
+		const uint32_t counter[4] = { (uint32_t)k, (uint32_t)(k >> 32), (uint32_t)(i / 4), 0 };
+		uint32_t bits[4];
+		Philox4x32::block(counter, seed, bits);
+		for (int j = 0; j < 4; j += 2) {
+			const double r = sqrt(-2.0 * log(Philox4x32::uniform(bits[j])));
+			const double theta = 2.0 * M_PI * Philox4x32::uniform(bits[j + 1]);
+			gauss[i + j] = r * cos(theta);
+			gauss[i + j + 1] = r * sin(theta);
+		}
+	}
+	for (int i = 0; i < dim; i++)
+		norm += gauss[i] * gauss[i];
+	norm = sqrt(norm);
+	for (int i = 0; i < dim; i++)
+		dir[i] = (T)(gauss[i] / norm);
+}
+
+
+// Inverse of the standard normal CDF (Acklam's rational approximation, relative
+// error below 1.2e-9), for p in (0, 1).
+inline double inverseNormalCdf(double p) {
+	static const double a[6] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+		1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+	static const double b[5] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+		6.680131188771972e+01, -1.328068155288572e+01 };
+	static const double c[6] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+		-2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+	static const double d[4] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+		3.754408661907416e+00 };
+	const double low = 0.02425;
+	if (p < low) {
+		const double q = sqrt(-2.0 * log(p));
+		return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+	}
+	if (p > 1.0 - low) {
+		const double q = sqrt(-2.0 * log(1.0 - p));
+		return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+	}
+	const double q = p - 0.5, r = q * q;
+	return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
+
+
+// k-th unit direction of a low-discrepancy sequence in dimension dim: point k of
+// the R_s additive recurrence (Roberts' generalization of the golden ratio
+// sequence, which can be extended without knowing the number of points) in
+// [0,1)^s, randomly shifted (Cranley-Patterson) by the seed, and mapped to the
+// sphere. As opposite directions define the same slice, the point is mapped to a
+// half-circle angle in 2D and to a hemisphere in 3D, with the area-preserving
+// cylinder projection (as spherical Fibonacci sets). In higher dimensions it is
+// mapped through the inverse normal CDF followed by a normalization.
+template<typename T>
+void qmcDirection(uint64_t seed, uint64_t k, int dim, T* dir) {
+	if (dim == 1) {
+		dir[0] = 1;
+		return;
+	}
+	const int s = (dim <= 3) ? dim - 1 : dim;
+
+	// phi_s is the positive root of x^(s+1) = x + 1
+	double phi = 2.0;
+	for (int it = 0; it < 32; it++)
+		phi = pow(1.0 + phi, 1.0 / (s + 1));
+
+	std::vector<double> u(dim);
+	double alpha = 1.0;
+	for (int j = 0; j < s; j++) {
+		if (j % 4 == 0) {
+			// random shift, from the blocks of counter (0, 0, j, 1) that randomDirection never uses
+			const uint32_t counter[4] = { 0, 0, (uint32_t)(j / 4), 1 };
+			uint32_t bits[4];
+			Philox4x32::block(counter, seed, bits);
+			for (int l = 0; l < 4 && j + l < s; l++)
+				u[j + l] = Philox4x32::uniform(bits[l]);
+		}
+		alpha /= phi;
+		const double x = u[j] + (double)k * alpha;
+		u[j] = x - floor(x);
+	}
+
+	if (dim == 2) {
+		dir[0] = (T)cos(M_PI * u[0]);
+		dir[1] = (T)sin(M_PI * u[0]);
+	} else if (dim == 3) {
+		const double z = u[0], r = sqrt(std::max(0.0, 1.0 - z * z));
+		dir[0] = (T)(r * cos(2.0 * M_PI * u[1]));
+		dir[1] = (T)(r * sin(2.0 * M_PI * u[1]));
+		dir[2] = (T)z;
+	} else {
+		double norm = 0.0;
+		for (int j = 0; j < dim; j++) {
+			u[j] = inverseNormalCdf(std::min(1.0 - 1e-12, std::max(1e-12, u[j])));
+			norm += u[j] * u[j];
+		}
+		norm = sqrt(norm);
+		for (int j = 0; j < dim; j++)
+			dir[j] = (T)(u[j] / norm);
+	}
+}
+
+
+// k-th direction of a sequence of random orthonormal bases in dimension dim: the
+// directions dim*b to dim*b + dim-1 form the b-th basis, obtained by the
+// Gram-Schmidt orthonormalization of the gaussian directions of the same indices.
+template<typename T>
+void orthobasisDirection(uint64_t seed, uint64_t k, int dim, T* dir) {
+	const uint64_t first = (k / dim) * dim;
+	const int c = (int)(k % dim);
+	std::vector<double> basis((size_t)(c + 1) * dim);
+	for (int i = 0; i <= c; i++) {
+		double *e = &basis[i * dim];
+		randomDirection(seed, first + i, dim, e);
+		// modified Gram-Schmidt, twice for a better orthogonality
+		for (int pass = 0; pass < 2; pass++)
+			for (int j = 0; j < i; j++) {
+				const double *f = &basis[j * dim];
+				double dot = 0.0;
+				for (int l = 0; l < dim; l++)
+					dot += e[l] * f[l];
+				for (int l = 0; l < dim; l++)
+					e[l] -= dot * f[l];
+			}
+		double norm = 0.0;
+		for (int l = 0; l < dim; l++)
+			norm += e[l] * e[l];
+		norm = sqrt(norm);
+		for (int l = 0; l < dim; l++)
+			e[l] /= norm;
+	}
+	for (int l = 0; l < dim; l++)
+		dir[l] = (T)basis[c * dim + l];
+}
+
+
+// Sequence of unit directions, as drawn by the transfer engines: the k-th
+// direction only depends on the schedule, the seed and k.
+//   GAUSSIAN:   independent random directions, randomDirection(seed, k, dim)
+//   ORTHOBASIS: random orthonormal bases, each group of dim consecutive directions
+//               being a basis (orthobasisDirection)
+//   QMC:        randomly shifted low-discrepancy sequence (qmcDirection)
+class DirectionSequence {
+public:
+	enum Schedule { GAUSSIAN, ORTHOBASIS, QMC };
+
+	static const uint64_t DEFAULT_SEED = 10;
+
+	DirectionSequence(int dim = 3, uint64_t seed = DEFAULT_SEED, Schedule schedule = GAUSSIAN)
+		: dim(dim), seed(seed), schedule(schedule), counter(0) {}
+
+	// schedule of a command line name: gaussian, orthobasis or qmc
+	static Schedule scheduleFromName(const std::string &name) {
+		if (name == "orthobasis") return ORTHOBASIS;
+		if (name == "qmc") return QMC;
+		return GAUSSIAN;
+	}
+
+	// command line name of a schedule
+	static const char* scheduleName(Schedule schedule) {
+		if (schedule == ORTHOBASIS) return "orthobasis";
+		if (schedule == QMC) return "qmc";
+		return "gaussian";
+	}
+
+	// k-th direction of the sequence
+	template<typename T>
+	void direction(uint64_t k, T* dir) const {
+		if (schedule == ORTHOBASIS)
+			orthobasisDirection(seed, k, dim, dir);
+		else if (schedule == QMC)
+			qmcDirection(seed, k, dim, dir);
+		else
+			randomDirection(seed, k, dim, dir);
+	}
+
+	// draws the next direction
+	template<typename T>
+	void next(T* dir) {
+		direction(counter++, dir);
+	}
+
+private:
+	int dim;
+	uint64_t seed;
+	Schedule schedule;
+	uint64_t counter;
+};
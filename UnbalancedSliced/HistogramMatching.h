@@ -0,0 +1,157 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Counting sort of 1D projections on a regular grid of bins, used by the approximate
+// (histogram) 1D matchers of the sliced transports. The values are ordered by bin, the
+// values of a bin keeping their input order, which sorts them up to the width of a bin
+// in O(n + nbBins) without any comparison. The cumulative histogram is the CDF of the
+// values: its inversion gives their quantile function, the values of a bin being
+// spread uniformly over it.
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "ThreadPool.h"
+
+
+template<typename T>
+class HistogramSorter {
+public:
+
+	HistogramSorter() : lo(0), width(1.0), nbChunks(1), chunk(0) {}
+
+	// cumulative histogram of values[0..n-1] on nbBins bins over their range
+	void histogram(const T* values, size_t n, size_t nbBins) {
+		ThreadPool &pool = ThreadPool::instance();
+		// each chunk owns nbBins counts: a chunk per nbBins values at most keeps the
+		// counts and their prefix sum O(n) however many threads there are
+		nbChunks = (n < (1 << 16) || ThreadPool::nested()) ? 1 : std::min((size_t)pool.size(), std::max((size_t)1, n / nbBins));
+		chunk = (n + nbChunks - 1) / nbChunks;
+		T hi;
+		valueRange(values, n, lo, hi);
+		width = (hi > lo) ? ((double)hi - (double)lo) / nbBins : 1.0;
+		const double scale = 1.0 / width;
+		bins.resize(n);
+		counts.assign(nbChunks * nbBins, 0);
+		const size_t last = nbBins - 1;
+		const T low = lo;
+		pool.parallelChunks(nbChunks, [&](size_t t) {
+			const size_t begin = std::min(n, t * chunk);
+			const size_t end = std::min(n, begin + chunk);
+			size_t* count = &counts[t * nbBins];
+			for (size_t i = begin; i < end; i++) {
+				bins[i] = (unsigned int)std::min(last, (size_t)(((double)values[i] - low) * scale));
+				count[bins[i]]++;
+			}
+		});
+
+		// exclusive prefix sum, bin-major then chunk-major: counts become the scatter
+		// positions of the chunks in argsort (which keeps the sort stable)
+		cumulative.resize(nbBins + 1);
+		size_t sum = 0;
+		for (size_t b = 0; b < nbBins; b++) {
+			cumulative[b] = sum;
+			for (size_t t = 0; t < nbChunks; t++) {
+				const size_t c = counts[t * nbBins + b];
+				counts[t * nbBins + b] = sum;
+				sum += c;
+			}
+		}
+		cumulative[nbBins] = sum;
+	}
+
+	// order[r] receives the index of the value of rank r, and sorted[r] (if not NULL)
+	// its value
+	void argsort(const T* values, size_t n, size_t nbBins, unsigned int* order, T* sorted = NULL) {
+		histogram(values, n, nbBins);
+		ThreadPool &pool = ThreadPool::instance();
+		pool.parallelChunks(nbChunks, [&](size_t t) {
+			const size_t begin = std::min(n, t * chunk);
+			const size_t end = std::min(n, begin + chunk);
+			size_t* next = &counts[t * nbBins];
+			for (size_t i = begin; i < end; i++)
+				order[next[bins[i]]++] = (unsigned int)i;
+		});
+		if (sorted)
+			pool.parallelFor(n, [&](size_t begin, size_t end) {
+				for (size_t r = begin; r < end; r++)
+					sorted[r] = values[order[r]];
+			});
+	}
+
+	// bin holding the fractional rank q in [0, n) of the last histogram
+	size_t findBin(double q) const {
+		return std::upper_bound(cumulative.begin(), cumulative.end(), (size_t)q) - cumulative.begin() - 1;
+	}
+
+	// value of the quantile function of the last histogram at the fractional rank q,
+	// bin being the bin of a lower rank (it is advanced to the bin of q), so that
+	// increasing ranks are inverted in a single sweep
+	T quantile(double q, size_t &bin) const {
+		while ((bin + 2 < cumulative.size()) && ((double)cumulative[bin + 1] <= q)) bin++;
+		const double count = (double)(cumulative[bin + 1] - cumulative[bin]);
+		const double offset = (count > 0) ? (q - cumulative[bin] + 0.5) / count : 0.5;
+		return (T)(lo + width * (bin + std::min(1.0, offset)));
+	}
+
+	// width of the bins of the last histogram
+	double binWidth() const { return width; }
+
+	static void valueRange(const T* values, size_t n, T &lo, T &hi) {
+		lo = hi = n ? values[0] : (T)0;
+		if (n < (1 << 16) || ThreadPool::nested()) {
+			for (size_t i = 1; i < n; i++) {
+				lo = std::min(lo, values[i]);
+				hi = std::max(hi, values[i]);
+			}
+			return;
+		}
+		ThreadPool &pool = ThreadPool::instance();
+		const size_t nbChunks = pool.size(), chunk = (n + nbChunks - 1) / nbChunks;
+		std::vector<T> los(nbChunks, lo), his(nbChunks, hi);
+		pool.parallelChunks(nbChunks, [&](size_t t) {
+			const size_t end = std::min(n, (t + 1) * chunk);
+			for (size_t i = std::min(n, t * chunk); i < end; i++) {
+				los[t] = std::min(los[t], values[i]);
+				his[t] = std::max(his[t], values[i]);
+			}
+		});
+		lo = *std::min_element(los.begin(), los.end());
+		hi = *std::max_element(his.begin(), his.end());
+	}
+
+private:
+	T lo;
+	double width;
+	size_t nbChunks, chunk;            // partition of the values among the threads
+	std::vector<unsigned int> bins;    // bin of each value
+	std::vector<size_t> cumulative;    // number of values before each bin (nbBins + 1)
+	std::vector<size_t> counts;        // scatter positions of each chunk in each bin
+};
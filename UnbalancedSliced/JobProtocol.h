@@ -0,0 +1,286 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Messages exchanged on the local (Unix domain) socket of the colorTransfer server
+// (colorTransfer --server, colorTransferClient). POSIX only.
+//
+// A message is a header line of space separated key=value fields, followed by an
+// optional binary payload of "payload" bytes:
+//   cmd=transfer target=beach source=/tmp/a.png nbsteps=20 payload=0\n
+// Values are escaped (%XX) so that they never contain spaces nor new lines.
+// The payload size is a decimal integer of at most MAX_PAYLOAD bytes.
+// A connection carries any number of request / reply pairs.
+
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SIGPIPE has to be ignored by the process
+#endif
+
+
+struct JobMessage {
+
+	bool has(const std::string &key) const {
+		return fields.find(key) != fields.end();
+	}
+
+	std::string get(const std::string &key, const std::string &defaultValue = "") const {
+		std::map<std::string, std::string>::const_iterator it = fields.find(key);
+		return (it == fields.end()) ? defaultValue : it->second;
+	}
+
+	double getNumber(const std::string &key, double defaultValue) const {
+		std::map<std::string, std::string>::const_iterator it = fields.find(key);
+		return (it == fields.end()) ? defaultValue : atof(it->second.c_str());
+	}
+
+	void set(const std::string &key, const std::string &value) {
+		fields[key] = value;
+	}
+
+	void set(const std::string &key, double value) {
+		std::ostringstream s;
+		s.precision(15);
+		s << value;
+		fields[key] = s.str();
+	}
+
+	std::map<std::string, std::string> fields;
+	std::vector<unsigned char> payload;
+};
+
+
+// buffered reads and writes of JobMessages on a connected socket
+class JobChannel {
+public:
+
+	static const size_t MAX_PAYLOAD = (size_t)256 << 20;
+
+	// timeoutMs: longest wait for data from the peer (0 = no limit)
+	explicit JobChannel(int fd, int timeoutMs = 0) : fd(fd), timeoutMs(timeoutMs), begin(0), end(0) {}
+
+	// returns false at the end of the connection, after the timeout or on a malformed
+	// message ; error() then describes the malformed message (empty otherwise)
+	bool read(JobMessage &msg) {
+		msg.fields.clear();
+		msg.payload.clear();
+		lastError.clear();
+		std::string line;
+		for (;;) {
+			if (begin == end && !fill()) return false;
+			const char *nl = (const char*)memchr(buffer + begin, '\n', end - begin);
+			const size_t stop = nl ? nl - buffer : end;
+			line.append(buffer + begin, stop - begin);
+			begin = nl ? stop + 1 : stop;
+			if (nl) break;
+			if (line.size() > MAX_HEADER) {
+				lastError = "Header too long";
+				return false;
+			}
+		}
+
+		std::istringstream fields(line);
+		std::string field;
+		while (fields >> field) {
+			const size_t eq = field.find('=');
+			if (eq == std::string::npos) {
+				lastError = "Malformed field " + field;
+				return false;
+			}
+			msg.fields[field.substr(0, eq)] = unescape(field.substr(eq + 1));
+		}
+
+		size_t size = 0;
+		if (!parseSize(msg.get("payload", "0"), size)) {
+			lastError = "Invalid payload size " + msg.get("payload") + " (at most " + std::to_string(MAX_PAYLOAD) + " bytes)";
+			return false;
+		}
+		msg.payload.resize(size);
+		size_t done = std::min(size, end - begin);
+		memcpy(msg.payload.data(), buffer + begin, done);
+		begin += done;
+		while (done < size) {
+			if (!wait()) return false;
+			const ssize_t n = ::read(fd, msg.payload.data() + done, size - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			done += n;
+		}
+		return true;
+	}
+
+	// description of the malformed message of the last read (empty if none)
+	const std::string& error() const {
+		return lastError;
+	}
+
+	// returns false if the message could not be sent
+	bool write(JobMessage &msg) {
+		msg.set("payload", (double)msg.payload.size());
+		std::string header;
+		for (std::map<std::string, std::string>::const_iterator it = msg.fields.begin(); it != msg.fields.end(); ++it) {
+			if (!header.empty()) header += ' ';
+			header += it->first + "=" + escape(it->second);
+		}
+		header += '\n';
+		return writeAll(header.data(), header.size()) && writeAll(msg.payload.data(), msg.payload.size());
+	}
+
+	static std::string escape(const std::string &value) {
+		static const char *hex = "0123456789ABCDEF";
+		std::string res;
+		for (size_t i = 0; i < value.size(); i++) {
+			const unsigned char c = value[i];
+			if (c <= ' ' || c == '%' || c == '=' || c >= 127) {
+				res += '%';
+				res += hex[c >> 4];
+				res += hex[c & 15];
+			} else
+				res += c;
+		}
+		return res;
+	}
+
+	static std::string unescape(const std::string &value) {
+		std::string res;
+		for (size_t i = 0; i < value.size(); i++) {
+			if (value[i] == '%' && i + 2 < value.size()) {
+				res += (char)strtol(value.substr(i + 1, 2).c_str(), NULL, 16);
+				i += 2;
+			} else
+				res += value[i];
+		}
+		return res;
+	}
+
+private:
+
+	static const size_t MAX_HEADER = 1 << 16;
+
+	// decimal integer in [0, MAX_PAYLOAD]
+	static bool parseSize(const std::string &value, size_t &size) {
+		if (value.empty()) return false;
+		size = 0;
+		for (size_t i = 0; i < value.size(); i++) {
+			if (value[i] < '0' || value[i] > '9') return false;
+			size = size * 10 + (value[i] - '0');
+			if (size > MAX_PAYLOAD) return false;
+		}
+		return true;
+	}
+
+	// waits until data can be read ; false after the timeout
+	bool wait() {
+		if (timeoutMs <= 0) return true;
+		pollfd pfd = {fd, POLLIN, 0};
+		for (;;) {
+			const int n = poll(&pfd, 1, timeoutMs);
+			if (n < 0 && errno == EINTR) continue;
+			return n > 0;
+		}
+	}
+
+	bool fill() {
+		for (;;) {
+			if (!wait()) return false;
+			const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			begin = 0;
+			end = n;
+			return true;
+		}
+	}
+
+	bool writeAll(const void *data, size_t size) {
+		const char *p = (const char*)data;
+		while (size > 0) {
+			const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	int fd;
+	int timeoutMs;
+	std::string lastError;
+	char buffer[1 << 16];
+	size_t begin, end;
+};
+
+
+// socket bound to path and listening ; -1 on error (an existing socket file is replaced)
+inline int listenUnixSocket(const std::string &path) {
+	sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// socket connected to the server listening on path ; -1 on error
+inline int connectUnixSocket(const std::string &path) {
+	sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
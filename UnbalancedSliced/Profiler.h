@@ -0,0 +1,220 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+
+
+// Process-wide, low-overhead phase profiler.
+// Disabled by default: a disabled Scope only tests a flag. When enabled, each
+// Scope adds its duration to the phase it names (durations of phases running
+// concurrently, e.g. the slices of a batch, are summed), and per-slice scopes
+// also record each duration for the slice statistics. The report is a JSON
+// file with the run information, the phase times and a log2 histogram of the
+// slice times (in microseconds).
+class Profiler {
+public:
+
+	typedef std::chrono::steady_clock Clock;
+
+	static Profiler& instance() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	void enable(bool e = true) {
+		enabled = e;
+		start = Clock::now();
+	}
+
+	bool isEnabled() const {
+		return enabled;
+	}
+
+	// adds a duration (in seconds) to a phase
+	void add(const char* phase, double seconds) {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (size_t i = 0; i < phases.size(); i++) {
+			if (phases[i].name == phase) {
+				phases[i].seconds += seconds;
+				phases[i].calls++;
+				return;
+			}
+		}
+		Phase p;
+		p.name = phase;
+		p.seconds = seconds;
+		p.calls = 1;
+		phases.push_back(p);
+	}
+
+	// total duration (in seconds) of a phase, 0 if it was not run
+	double seconds(const char* phase) const {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (size_t i = 0; i < phases.size(); i++)
+			if (phases[i].name == phase) return phases[i].seconds;
+		return 0.0;
+	}
+
+	// forgets the phases, slices and run information recorded so far
+	void reset() {
+		std::unique_lock<std::mutex> lock(mutex);
+		phases.clear();
+		slices.clear();
+		info.clear();
+		start = Clock::now();
+	}
+
+	// records the duration (in seconds) of one slice
+	void addSlice(double seconds) {
+		std::unique_lock<std::mutex> lock(mutex);
+		slices.push_back(seconds);
+	}
+
+	// run information written in the report (tool, parameters, sizes...)
+	void setInfo(const std::string &key, const std::string &value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		info.push_back(std::make_pair(key, "\"" + escape(value) + "\""));
+	}
+	void setInfo(const std::string &key, double value) {
+		std::ostringstream oss;
+		oss.precision(15);
+		oss << value;
+		std::unique_lock<std::mutex> lock(mutex);
+		info.push_back(std::make_pair(key, oss.str()));
+	}
+
+	// returns false on I/O error
+	bool saveJson(const std::string &filename) const {
+		std::unique_lock<std::mutex> lock(mutex);
+		std::ofstream ofs(filename);
+		if (!ofs) return false;
+		const double wall = std::chrono::duration<double>(Clock::now() - start).count();
+		ofs << "{\n  \"info\": {";
+		for (size_t i = 0; i < info.size(); i++)
+			ofs << (i ? ", " : "") << "\"" << escape(info[i].first) << "\": " << info[i].second;
+		ofs << "},\n  \"wall_seconds\": " << wall << ",\n  \"phases\": {";
+		for (size_t i = 0; i < phases.size(); i++)
+			ofs << (i ? "," : "") << "\n    \"" << escape(phases[i].name) << "\": {\"seconds\": " << phases[i].seconds << ", \"calls\": " << phases[i].calls << "}";
+		ofs << "\n  },\n  \"slices\": {";
+
+		std::vector<double> sorted(slices);
+		std::sort(sorted.begin(), sorted.end());
+		ofs << "\"count\": " << sorted.size();
+		if (!sorted.empty()) {
+			double sum = 0.0;
+			for (size_t i = 0; i < sorted.size(); i++) sum += sorted[i];
+			ofs << ", \"mean_seconds\": " << sum / sorted.size()
+			    << ", \"min_seconds\": " << sorted.front()
+			    << ", \"p50_seconds\": " << percentile(sorted, 0.5)
+			    << ", \"p90_seconds\": " << percentile(sorted, 0.9)
+			    << ", \"p99_seconds\": " << percentile(sorted, 0.99)
+			    << ", \"max_seconds\": " << sorted.back();
+			// bin k counts the slices lasting [2^k, 2^(k+1)) microseconds
+			std::vector<size_t> bins;
+			for (size_t i = 0; i < sorted.size(); i++) {
+				const double us = sorted[i] * 1e6;
+				const size_t k = (us < 1.0) ? 0 : (size_t)std::floor(std::log2(us));
+				if (k >= bins.size()) bins.resize(k + 1, 0);
+				bins[k]++;
+			}
+			ofs << ",\n    \"histogram_log2_us\": [";
+			bool first = true;
+			for (size_t k = 0; k < bins.size(); k++) {
+				if (!bins[k]) continue;
+				ofs << (first ? "" : ", ") << "{\"from_us\": " << (k ? (1ull << k) : 0) << ", \"to_us\": " << (2ull << k) << ", \"count\": " << bins[k] << "}";
+				first = false;
+			}
+			ofs << "]";
+		}
+		ofs << "}\n}\n";
+		return (bool)ofs;
+	}
+
+	// times the enclosing scope when the profiler is enabled
+	class Scope {
+	public:
+		Scope(const char* phase, bool slice = false) : phase(Profiler::instance().enabled ? phase : NULL), slice(slice) {
+			if (this->phase) t0 = Clock::now();
+		}
+		~Scope() {
+			stop();
+		}
+		// records the duration now instead of at the end of the scope
+		void stop() {
+			if (!phase) return;
+			const double seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+			Profiler::instance().add(phase, seconds);
+			if (slice) Profiler::instance().addSlice(seconds);
+			phase = NULL;
+		}
+	private:
+		const char* phase;
+		bool slice;
+		Clock::time_point t0;
+	};
+
+private:
+
+	struct Phase {
+		std::string name;
+		double seconds;
+		size_t calls;
+	};
+
+	Profiler() : enabled(false), start(Clock::now()) {}
+
+	static double percentile(const std::vector<double> &sorted, double q) {
+		return sorted[std::min(sorted.size() - 1, (size_t)(q * (sorted.size() - 1) + 0.5))];
+	}
+
+	static std::string escape(const std::string &s) {
+		std::string res;
+		for (size_t i = 0; i < s.size(); i++) {
+			if (s[i] == '"' || s[i] == '\\') res += '\\';
+			if ((unsigned char)s[i] < 0x20) continue;
+			res += s[i];
+		}
+		return res;
+	}
+
+	bool enabled;
+	Clock::time_point start;
+	mutable std::mutex mutex;
+	std::vector<Phase> phases;
+	std::vector<double> slices;
+	std::vector<std::pair<std::string, std::string> > info;
+};
@@ -0,0 +1,60 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstddef>
+
+
+// Piecewise-linear quantile functions of 1D distributions.
+// A quantile function is stored as K knots: knot j is the value at mass
+// position j/(K-1) of the sorted samples. A sorted set of n samples is itself
+// a quantile function with n knots, so that matching n source ranks against
+// n knots is the exact 1D optimal transport.
+
+// value of the quantile function at the fractional knot position pos in [0, K-1]
+inline float quantileAt(const float* knots, size_t K, double pos) {
+	size_t j = (size_t)pos;
+	if (j >= K - 1) return knots[K - 1];
+	double t = pos - (double)j;
+	if (t == 0.0) return knots[j];
+	return (float)((1.0 - t) * knots[j] + t * knots[j + 1]);
+}
+
+// value of the quantile function at the rank i of a sorted set of n samples
+// (first and last ranks map to the first and last knots)
+inline float quantileAtRank(const float* knots, size_t K, size_t i, size_t n) {
+	if (n < 2 || K < 2) return knots[0];
+	return quantileAt(knots, K, (double)i * (double)(K - 1) / (double)(n - 1));
+}
+
+// reduces n sorted samples to K knots of their quantile function
+inline void sampleQuantiles(const float* sorted, size_t n, float* knots, size_t K) {
+	for (size_t j = 0; j < K; j++)
+		knots[j] = quantileAtRank(sorted, n, j, K);
+}
@@ -0,0 +1,194 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "ThreadPool.h"
+
+
+// maps floating point keys to unsigned integers with the same ordering:
+// the sign bit is flipped for positive values, all bits are flipped for negative ones
+template<typename T>
+struct RadixKey;
+
+template<>
+struct RadixKey<float> {
+	typedef uint32_t type;
+	static type encode(float f) {
+		type u;
+		memcpy(&u, &f, sizeof(u));
+		return u ^ ((type)(-(int32_t)(u >> 31)) | 0x80000000u);
+	}
+	static float decode(type u) {
+		u ^= ((u >> 31) - 1) | 0x80000000u;
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+};
+
+template<>
+struct RadixKey<double> {
+	typedef uint64_t type;
+	static type encode(double f) {
+		type u;
+		memcpy(&u, &f, sizeof(u));
+		return u ^ ((type)(-(int64_t)(u >> 63)) | 0x8000000000000000ull);
+	}
+	static double decode(type u) {
+		u ^= ((u >> 63) - 1) | 0x8000000000000000ull;
+		double f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+};
+
+
+// Multi-threaded LSD radix sort of floating point keys carrying 32-bit indices, running on the ThreadPool.
+// The sort is stable and its output does not depend on the number of threads.
+// Working buffers are kept between calls so that a sorter can be reused across slices.
+template<typename T>
+class RadixSorter {
+public:
+	typedef typename RadixKey<T>::type Key;
+
+	static const int DIGIT_BITS = 11;
+	static const int NB_BUCKETS = 1 << DIGIT_BITS;
+	static const int NB_PASSES = (8 * sizeof(Key) + DIGIT_BITS - 1) / DIGIT_BITS;
+
+	// computes the permutation idx sorting keys[0..n-1] in increasing order (keys are left untouched)
+	// if sortedKeys is not NULL, the sorted keys are written there as well
+	void argsort(const T* keys, unsigned int* idx, size_t n, T* sortedKeys = NULL) {
+		ukeys.resize(n);
+		ukeysTmp.resize(n);
+		values.resize(n);
+		valuesTmp.resize(n);
+		ThreadPool &pool = ThreadPool::instance();
+
+		pool.parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				ukeys[i] = RadixKey<T>::encode(keys[i]);
+				values[i] = (unsigned int)i;
+			}
+		});
+
+		sortEncoded(n);
+
+		pool.parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				idx[i] = values[i];
+				if (sortedKeys) sortedKeys[i] = RadixKey<T>::decode(ukeys[i]);
+			}
+		});
+	}
+
+	// sorts keys[0..n-1] in place, applying the same permutation to the values
+	void sort(T* keys, unsigned int* vals, size_t n) {
+		ukeys.resize(n);
+		ukeysTmp.resize(n);
+		values.resize(n);
+		valuesTmp.resize(n);
+		ThreadPool &pool = ThreadPool::instance();
+
+		pool.parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				ukeys[i] = RadixKey<T>::encode(keys[i]);
+				values[i] = vals[i];
+			}
+		});
+
+		sortEncoded(n);
+
+		pool.parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				keys[i] = RadixKey<T>::decode(ukeys[i]);
+				vals[i] = values[i];
+			}
+		});
+	}
+
+private:
+
+	// sorts (ukeys, values) ; the result is stored back in ukeys and values
+	void sortEncoded(size_t n) {
+		ThreadPool &pool = ThreadPool::instance();
+		size_t nbThreads = (n < (1 << 16) || ThreadPool::nested()) ? 1 : pool.size();
+		histograms.resize(nbThreads * NB_BUCKETS);
+		size_t chunk = (n + nbThreads - 1) / nbThreads;
+
+		for (int pass = 0; pass < NB_PASSES; pass++) {
+			const int shift = pass * DIGIT_BITS;
+
+			pool.parallelChunks(nbThreads, [&](size_t t) {
+				const size_t begin = std::min(n, t * chunk);
+				const size_t end = std::min(n, begin + chunk);
+				size_t* hist = &histograms[t * NB_BUCKETS];
+				memset(hist, 0, NB_BUCKETS * sizeof(size_t));
+				for (size_t i = begin; i < end; i++)
+					hist[(ukeys[i] >> shift) & (NB_BUCKETS - 1)]++;
+			});
+
+			// exclusive prefix sum, bucket-major then thread-major to keep the sort stable
+			bool trivial = false;
+			size_t sum = 0;
+			for (int b = 0; b < NB_BUCKETS; b++) {
+				size_t total = 0;
+				for (size_t th = 0; th < nbThreads; th++) {
+					size_t c = histograms[th * NB_BUCKETS + b];
+					histograms[th * NB_BUCKETS + b] = sum;
+					sum += c;
+					total += c;
+				}
+				if (total == n) trivial = true; // all keys share this digit: nothing to do
+			}
+			if (trivial) continue;
+
+			pool.parallelChunks(nbThreads, [&](size_t t) {
+				const size_t begin = std::min(n, t * chunk);
+				const size_t end = std::min(n, begin + chunk);
+				size_t* hist = &histograms[t * NB_BUCKETS];
+				for (size_t i = begin; i < end; i++) {
+					size_t pos = hist[(ukeys[i] >> shift) & (NB_BUCKETS - 1)]++;
+					ukeysTmp[pos] = ukeys[i];
+					valuesTmp[pos] = values[i];
+				}
+			});
+
+			ukeys.swap(ukeysTmp);
+			values.swap(valuesTmp);
+		}
+	}
+
+	std::vector<Key> ukeys, ukeysTmp;
+	std::vector<unsigned int> values, valuesTmp;
+	std::vector<size_t> histograms;
+};
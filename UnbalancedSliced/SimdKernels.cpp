@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Scalar kernels of SimdKernels.h and selection of the implementation
+#define SIMD_KERNELS_LEVEL 0
+#define SIMD_KERNELS_NAME "scalar"
+#define SIMD_KERNELS_TABLE simdKernelsScalar
+#include "SimdKernelsImpl.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+extern const SimdKernelTable simdKernelsSSE2;
+extern const SimdKernelTable simdKernelsAVX2;
+extern const SimdKernelTable simdKernelsAVX512;
+
+namespace {
+
+	// highest level supported by the CPU and the OS: 0 scalar, 1 SSE2, 2 AVX2+FMA, 3 AVX-512
+	int cpuLevel() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		const int nbLeaves = info[0];
+		__cpuid(info, 1);
+		const bool sse2 = (info[3] >> 26) & 1;
+		const bool fma = (info[2] >> 12) & 1;
+		const bool osxsave = (info[2] >> 27) & 1;
+		bool avx2 = false, avx512 = false;
+		if (nbLeaves >= 7) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] >> 5) & 1;
+			avx512 = (info[1] >> 16) & 1;
+		}
+		// registers saved by the OS: YMM (bits 1-2), and opmask and ZMM (bits 5-7)
+		const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		const bool ymm = (xcr0 & 0x6) == 0x6, zmm = (xcr0 & 0xe6) == 0xe6;
+		if (avx512 && avx2 && fma && zmm) return 3;
+		if (avx2 && fma && ymm) return 2;
+		return sse2 ? 1 : 0;
+#else
+		__builtin_cpu_init();
+		const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		if (avx2 && __builtin_cpu_supports("avx512f")) return 3;
+		if (avx2) return 2;
+		return __builtin_cpu_supports("sse2") ? 1 : 0;
+#endif
+	}
+
+	const SimdKernelTable* selectKernels() {
+		const SimdKernelTable* tables[] = { &simdKernelsScalar, &simdKernelsSSE2, &simdKernelsAVX2, &simdKernelsAVX512 };
+		int level = cpuLevel();
+		const char* forced = std::getenv("OTCT_SIMD");
+		if (forced) {
+			for (int l = 0; l < level; l++)
+				if (!std::strcmp(forced, tables[l]->name)) level = l;
+		}
+		return tables[level];
+	}
+
+}
+
+const SimdKernelTable& simdKernels() {
+	static const SimdKernelTable* kernels = selectKernels();
+	return *kernels;
+}
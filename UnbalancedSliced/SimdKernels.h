@@ -0,0 +1,112 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Vectorized kernels on planar (one array per channel) point sets, and the
+// kernels of the 1D transport (sums of costs, nearest neighbor scans).
+// Each kernel is compiled for several instruction sets (scalar, SSE2, AVX2+FMA,
+// AVX-512, see SimdKernelsImpl.h) and the implementation matching the CPU is
+// selected at runtime, on first use. The implementations perform the same
+// operations, in the same order (no FMA contraction), so that results do not
+// depend on the selected instruction set. The OTCT_SIMD environment variable
+// (scalar, sse2, avx2 or avx512) restricts the selection to a lower instruction set.
+
+#include <cstddef>
+
+
+// one implementation of the kernels
+struct SimdKernelTable {
+	const char* name;
+
+	void (*projectFloat)(const float* const* channels, const float* dir, int dim, size_t begin, size_t end, float* out);
+	void (*projectDouble)(const double* const* channels, const double* dir, int dim, size_t begin, size_t end, double* out);
+	void (*accumulateFloat)(float* acc, const float* disp, float w, size_t begin, size_t end);
+	void (*accumulateDouble)(double* acc, const double* disp, double w, size_t begin, size_t end);
+	void (*advectFloat)(float* x, const float* acc, double factor, double divisor, size_t begin, size_t end);
+	void (*advectDouble)(double* x, const double* acc, double factor, double divisor, size_t begin, size_t end);
+	float (*sumCostsFloat)(const float* h1, int start1, const float* h2, int start2, int n);
+	double (*sumCostsDouble)(const double* h1, int start1, const double* h2, int start2, int n);
+	int (*scanFloat)(const float* values, int n, float h, float mind, float threshold, int &lastMin);
+	int (*scanDouble)(const double* values, int n, double h, double mind, double threshold, int &lastMin);
+};
+
+// the implementation selected for this CPU
+const SimdKernelTable& simdKernels();
+
+
+// out[i] = sum_k dir[k] * channels[k][i] for i in [begin, end)
+inline void projectPlanar(const float* const* channels, const float* dir, int dim, size_t begin, size_t end, float* out) {
+	simdKernels().projectFloat(channels, dir, dim, begin, end, out);
+}
+
+inline void projectPlanar(const double* const* channels, const double* dir, int dim, size_t begin, size_t end, double* out) {
+	simdKernels().projectDouble(channels, dir, dim, begin, end, out);
+}
+
+
+// acc[i] += w * disp[i] for i in [begin, end)
+inline void accumulateDisplacement(float* acc, const float* disp, float w, size_t begin, size_t end) {
+	simdKernels().accumulateFloat(acc, disp, w, begin, end);
+}
+
+inline void accumulateDisplacement(double* acc, const double* disp, double w, size_t begin, size_t end) {
+	simdKernels().accumulateDouble(acc, disp, w, begin, end);
+}
+
+
+// x[i] += factor * acc[i] / divisor for i in [begin, end), evaluated in double precision
+inline void advectPlanar(float* x, const float* acc, double factor, double divisor, size_t begin, size_t end) {
+	simdKernels().advectFloat(x, acc, factor, divisor, begin, end);
+}
+
+inline void advectPlanar(double* x, const double* acc, double factor, double divisor, size_t begin, size_t end) {
+	simdKernels().advectDouble(x, acc, factor, divisor, begin, end);
+}
+
+
+// sum of the costs of matching h1[start1 + i] to h2[start2 + i] for i in [0, n)
+inline float sumCosts(const float* h1, int start1, const float* h2, int start2, int n) {
+	return simdKernels().sumCostsFloat(h1, start1, h2, start2, n);
+}
+
+inline double sumCosts(const double* h1, int start1, const double* h2, int start2, int n) {
+	return simdKernels().sumCostsDouble(h1, start1, h2, start2, n);
+}
+
+
+// costs of h to values[0..n-1], known to be non-decreasing and not below mind:
+// returns the first index whose cost is above threshold (n if none), lastMin
+// receiving the last index before it whose cost is mind (-1 if none)
+inline int scanNonDecreasing(const float* values, int n, float h, float mind, float threshold, int &lastMin) {
+	return simdKernels().scanFloat(values, n, h, mind, threshold, lastMin);
+}
+
+inline int scanNonDecreasing(const double* values, int n, double h, double mind, double threshold, int &lastMin) {
+	return simdKernels().scanDouble(values, n, h, mind, threshold, lastMin);
+}
@@ -0,0 +1,473 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Implementation of the kernels of SimdKernels.h for one instruction set,
+// included by one translation unit per instruction set, which defines
+// SIMD_KERNELS_LEVEL (0: scalar, 1: SSE2, 2: AVX2+FMA, 3: AVX-512), is compiled
+// with the matching flags (CMakeLists.txt) and names the table SIMD_KERNELS_TABLE.
+// The wider loops of a level are followed by the narrower ones for the remaining
+// elements; the reductions (sums of costs) always use 8 float or 4 double lanes,
+// added in the same order whatever the level.
+// Everything but the table has internal linkage, so that code compiled for a
+// higher instruction set cannot be picked by the linker for the other units.
+
+#include "SimdKernels.h"
+
+#if SIMD_KERNELS_LEVEL > 0
+#ifdef _MSC_VER
+  #include <intrin.h>
+#else
+  #include <immintrin.h>
+#endif
+#endif
+
+
+namespace {
+
+	// cost function in 1-d (same as cost() in UnbalancedSliced.cpp)
+	inline float cost(float x, float y) {
+		const float z = x - y;
+		return z*z;
+	}
+	inline double cost(double x, double y) {
+		const double z = x - y;
+		return z*z;
+	}
+#if SIMD_KERNELS_LEVEL >= 1
+	inline __m128 cost(__m128 x, __m128 y) {
+		const __m128 z = _mm_sub_ps(x, y);
+		return _mm_mul_ps(z, z);
+	}
+	inline __m128d cost(__m128d x, __m128d y) {
+		const __m128d z = _mm_sub_pd(x, y);
+		return _mm_mul_pd(z, z);
+	}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+	inline __m256 cost(__m256 x, __m256 y) {
+		const __m256 z = _mm256_sub_ps(x, y);
+		return _mm256_mul_ps(z, z);
+	}
+	inline __m256d cost(__m256d x, __m256d y) {
+		const __m256d z = _mm256_sub_pd(x, y);
+		return _mm256_mul_pd(z, z);
+	}
+#endif
+#if SIMD_KERNELS_LEVEL >= 3
+	inline __m512 cost(__m512 x, __m512 y) {
+		const __m512 z = _mm512_sub_ps(x, y);
+		return _mm512_mul_ps(z, z);
+	}
+	inline __m512d cost(__m512d x, __m512d y) {
+		const __m512d z = _mm512_sub_pd(x, y);
+		return _mm512_mul_pd(z, z);
+	}
+#endif
+
+
+	void projectFloat(const float* const* channels, const float* dir, int dim, size_t begin, size_t end, float* out) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		for (; i + 16 <= end; i += 16) {
+			__m512 s = _mm512_mul_ps(_mm512_set1_ps(dir[0]), _mm512_loadu_ps(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_set1_ps(dir[k]), _mm512_loadu_ps(channels[k] + i)));
+			_mm512_storeu_ps(out + i, s);
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		for (; i + 8 <= end; i += 8) {
+			__m256 s = _mm256_mul_ps(_mm256_set1_ps(dir[0]), _mm256_loadu_ps(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_set1_ps(dir[k]), _mm256_loadu_ps(channels[k] + i)));
+			_mm256_storeu_ps(out + i, s);
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		for (; i + 4 <= end; i += 4) {
+			__m128 s = _mm_mul_ps(_mm_set1_ps(dir[0]), _mm_loadu_ps(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(dir[k]), _mm_loadu_ps(channels[k] + i)));
+			_mm_storeu_ps(out + i, s);
+		}
+#endif
+		for (; i < end; i++) {
+			float s = dir[0] * channels[0][i];
+			for (int k = 1; k < dim; k++)
+				s += dir[k] * channels[k][i];
+			out[i] = s;
+		}
+	}
+
+	void projectDouble(const double* const* channels, const double* dir, int dim, size_t begin, size_t end, double* out) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		for (; i + 8 <= end; i += 8) {
+			__m512d s = _mm512_mul_pd(_mm512_set1_pd(dir[0]), _mm512_loadu_pd(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm512_add_pd(s, _mm512_mul_pd(_mm512_set1_pd(dir[k]), _mm512_loadu_pd(channels[k] + i)));
+			_mm512_storeu_pd(out + i, s);
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		for (; i + 4 <= end; i += 4) {
+			__m256d s = _mm256_mul_pd(_mm256_set1_pd(dir[0]), _mm256_loadu_pd(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm256_add_pd(s, _mm256_mul_pd(_mm256_set1_pd(dir[k]), _mm256_loadu_pd(channels[k] + i)));
+			_mm256_storeu_pd(out + i, s);
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		for (; i + 2 <= end; i += 2) {
+			__m128d s = _mm_mul_pd(_mm_set1_pd(dir[0]), _mm_loadu_pd(channels[0] + i));
+			for (int k = 1; k < dim; k++)
+				s = _mm_add_pd(s, _mm_mul_pd(_mm_set1_pd(dir[k]), _mm_loadu_pd(channels[k] + i)));
+			_mm_storeu_pd(out + i, s);
+		}
+#endif
+		for (; i < end; i++) {
+			double s = dir[0] * channels[0][i];
+			for (int k = 1; k < dim; k++)
+				s += dir[k] * channels[k][i];
+			out[i] = s;
+		}
+	}
+
+
+	void accumulateFloat(float* acc, const float* disp, float w, size_t begin, size_t end) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		const __m512 w16 = _mm512_set1_ps(w);
+		for (; i + 16 <= end; i += 16)
+			_mm512_storeu_ps(acc + i, _mm512_add_ps(_mm512_loadu_ps(acc + i), _mm512_mul_ps(w16, _mm512_loadu_ps(disp + i))));
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		const __m256 w8 = _mm256_set1_ps(w);
+		for (; i + 8 <= end; i += 8)
+			_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(w8, _mm256_loadu_ps(disp + i))));
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		const __m128 w4 = _mm_set1_ps(w);
+		for (; i + 4 <= end; i += 4)
+			_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(w4, _mm_loadu_ps(disp + i))));
+#endif
+		for (; i < end; i++)
+			acc[i] += w * disp[i];
+	}
+
+	void accumulateDouble(double* acc, const double* disp, double w, size_t begin, size_t end) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		const __m512d w8 = _mm512_set1_pd(w);
+		for (; i + 8 <= end; i += 8)
+			_mm512_storeu_pd(acc + i, _mm512_add_pd(_mm512_loadu_pd(acc + i), _mm512_mul_pd(w8, _mm512_loadu_pd(disp + i))));
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		const __m256d w4 = _mm256_set1_pd(w);
+		for (; i + 4 <= end; i += 4)
+			_mm256_storeu_pd(acc + i, _mm256_add_pd(_mm256_loadu_pd(acc + i), _mm256_mul_pd(w4, _mm256_loadu_pd(disp + i))));
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		const __m128d w2 = _mm_set1_pd(w);
+		for (; i + 2 <= end; i += 2)
+			_mm_storeu_pd(acc + i, _mm_add_pd(_mm_loadu_pd(acc + i), _mm_mul_pd(w2, _mm_loadu_pd(disp + i))));
+#endif
+		for (; i < end; i++)
+			acc[i] += w * disp[i];
+	}
+
+
+	void advectFloat(float* x, const float* acc, double factor, double divisor, size_t begin, size_t end) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		const __m512d f8 = _mm512_set1_pd(factor), d8 = _mm512_set1_pd(divisor);
+		for (; i + 8 <= end; i += 8) {
+			__m512d a = _mm512_div_pd(_mm512_mul_pd(f8, _mm512_cvtps_pd(_mm256_loadu_ps(acc + i))), d8);
+			_mm256_storeu_ps(x + i, _mm512_cvtpd_ps(_mm512_add_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i)), a)));
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		const __m256d f4 = _mm256_set1_pd(factor), d4 = _mm256_set1_pd(divisor);
+		for (; i + 4 <= end; i += 4) {
+			__m256d a = _mm256_div_pd(_mm256_mul_pd(f4, _mm256_cvtps_pd(_mm_loadu_ps(acc + i))), d4);
+			_mm_storeu_ps(x + i, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(x + i)), a)));
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		// 2 floats per step, loaded and stored as 64-bit integers
+		const __m128d f2 = _mm_set1_pd(factor), d2 = _mm_set1_pd(divisor);
+		for (; i + 2 <= end; i += 2) {
+			__m128d a = _mm_div_pd(_mm_mul_pd(f2, _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(acc + i))))), d2);
+			__m128d v = _mm_add_pd(_mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(x + i)))), a);
+			_mm_storel_epi64((__m128i*)(x + i), _mm_castps_si128(_mm_cvtpd_ps(v)));
+		}
+#endif
+		for (; i < end; i++)
+			x[i] += factor * acc[i] / divisor;
+	}
+
+	void advectDouble(double* x, const double* acc, double factor, double divisor, size_t begin, size_t end) {
+		size_t i = begin;
+#if SIMD_KERNELS_LEVEL >= 3
+		const __m512d f8 = _mm512_set1_pd(factor), d8 = _mm512_set1_pd(divisor);
+		for (; i + 8 <= end; i += 8)
+			_mm512_storeu_pd(x + i, _mm512_add_pd(_mm512_loadu_pd(x + i), _mm512_div_pd(_mm512_mul_pd(f8, _mm512_loadu_pd(acc + i)), d8)));
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		const __m256d f4 = _mm256_set1_pd(factor), d4 = _mm256_set1_pd(divisor);
+		for (; i + 4 <= end; i += 4)
+			_mm256_storeu_pd(x + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_div_pd(_mm256_mul_pd(f4, _mm256_loadu_pd(acc + i)), d4)));
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		const __m128d f2 = _mm_set1_pd(factor), d2 = _mm_set1_pd(divisor);
+		for (; i + 2 <= end; i += 2)
+			_mm_storeu_pd(x + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_div_pd(_mm_mul_pd(f2, _mm_loadu_pd(acc + i)), d2)));
+#endif
+		for (; i < end; i++)
+			x[i] += factor * acc[i] / divisor;
+	}
+
+
+	// the values of h1 before the first multiple of 8 (resp. 4) index are summed one
+	// by one, then 8 (resp. 4) partial sums are accumulated over the blocks and added
+	// from the first to the last lane, and the remaining values are summed one by one
+	float sumCostsFloat(const float* h1, int start1, const float* h2, int start2, int n) {
+		float s = 0;
+		if (n < 32) {
+			for (int j = 0; j < n; j++)
+				s += cost(h1[start1 + j], h2[start2 + j]);
+			return s;
+		}
+		while (start1 % 8 != 0) {
+			s += cost(h1[start1], h2[start2]);
+			start1++;
+			start2++;
+			n--;
+		}
+		const float* h1p = &h1[start1];
+		const float* h2p = &h2[start2];
+		float lanes[8];
+		int j = 0;
+#if SIMD_KERNELS_LEVEL >= 2
+		__m256 s8 = _mm256_setzero_ps();
+		for (; j < n - 7; j += 8)
+			s8 = _mm256_add_ps(s8, cost(_mm256_loadu_ps(h1p + j), _mm256_loadu_ps(h2p + j)));
+		_mm256_storeu_ps(lanes, s8);
+#elif SIMD_KERNELS_LEVEL >= 1
+		__m128 lo = _mm_setzero_ps(), hi = _mm_setzero_ps();
+		for (; j < n - 7; j += 8) {
+			lo = _mm_add_ps(lo, cost(_mm_loadu_ps(h1p + j), _mm_loadu_ps(h2p + j)));
+			hi = _mm_add_ps(hi, cost(_mm_loadu_ps(h1p + j + 4), _mm_loadu_ps(h2p + j + 4)));
+		}
+		_mm_storeu_ps(lanes, lo);
+		_mm_storeu_ps(lanes + 4, hi);
+#else
+		for (int k = 0; k < 8; k++)
+			lanes[k] = 0;
+		for (; j < n - 7; j += 8)
+			for (int k = 0; k < 8; k++)
+				lanes[k] += cost(h1p[j + k], h2p[j + k]);
+#endif
+		s += lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+		for (; j < n; j++)
+			s += cost(h1p[j], h2p[j]);
+		return s;
+	}
+
+	double sumCostsDouble(const double* h1, int start1, const double* h2, int start2, int n) {
+		double s = 0;
+		if (n < 32) {
+			for (int j = 0; j < n; j++)
+				s += cost(h1[start1 + j], h2[start2 + j]);
+			return s;
+		}
+		while (start1 % 4 != 0) {
+			s += cost(h1[start1], h2[start2]);
+			start1++;
+			start2++;
+			n--;
+		}
+		const double* h1p = &h1[start1];
+		const double* h2p = &h2[start2];
+		double lanes[4];
+		int j = 0;
+#if SIMD_KERNELS_LEVEL >= 2
+		__m256d s4 = _mm256_setzero_pd();
+		for (; j < n - 3; j += 4)
+			s4 = _mm256_add_pd(s4, cost(_mm256_loadu_pd(h1p + j), _mm256_loadu_pd(h2p + j)));
+		_mm256_storeu_pd(lanes, s4);
+#elif SIMD_KERNELS_LEVEL >= 1
+		__m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+		for (; j < n - 3; j += 4) {
+			lo = _mm_add_pd(lo, cost(_mm_loadu_pd(h1p + j), _mm_loadu_pd(h2p + j)));
+			hi = _mm_add_pd(hi, cost(_mm_loadu_pd(h1p + j + 2), _mm_loadu_pd(h2p + j + 2)));
+		}
+		_mm_storeu_pd(lanes, lo);
+		_mm_storeu_pd(lanes + 2, hi);
+#else
+		for (int k = 0; k < 4; k++)
+			lanes[k] = 0;
+		for (; j < n - 3; j += 4)
+			for (int k = 0; k < 4; k++)
+				lanes[k] += cost(h1p[j + k], h2p[j + k]);
+#endif
+		s += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		for (; j < n; j++)
+			s += cost(h1p[j], h2p[j]);
+		return s;
+	}
+
+
+#if SIMD_KERNELS_LEVEL >= 1
+	// indices of the lowest and highest set bits of a non-zero mask
+	inline int lowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int)index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+	inline int highestBit(unsigned int mask) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, mask);
+		return (int)index;
+#else
+		return 31 - __builtin_clz(mask);
+#endif
+	}
+
+	// one block of W lanes, given the lanes whose cost is at most mind (atMin) and
+	// above threshold (above): returns the first lane above threshold (W if none),
+	// lastMin receiving the last lane before it at the minimum (unchanged if none)
+	inline int scanMasks(unsigned int atMin, unsigned int above, int W, int offset, int &lastMin) {
+		const int stop = lowestBit(above | (1u << W));
+		atMin &= (1u << stop) - 1;
+		if (atMin) lastMin = offset + highestBit(atMin);
+		return stop;
+	}
+#endif
+
+	// blocks of compares, then one by one
+	int scanFloat(const float* values, int n, float h, float mind, float threshold, int &lastMin) {
+		lastMin = -1;
+		int j = 0;
+#if SIMD_KERNELS_LEVEL >= 3
+		{
+			const __m512 h16 = _mm512_set1_ps(h), mind16 = _mm512_set1_ps(mind), threshold16 = _mm512_set1_ps(threshold);
+			for (; j + 16 <= n; j += 16) {
+				const __m512 d = cost(h16, _mm512_loadu_ps(values + j));
+				const int stop = scanMasks(_mm512_cmp_ps_mask(d, mind16, _CMP_LE_OQ), _mm512_cmp_ps_mask(d, threshold16, _CMP_GT_OQ), 16, j, lastMin);
+				if (stop < 16) return j + stop;
+			}
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		{
+			const __m256 h8 = _mm256_set1_ps(h), mind8 = _mm256_set1_ps(mind), threshold8 = _mm256_set1_ps(threshold);
+			for (; j + 8 <= n; j += 8) {
+				const __m256 d = cost(h8, _mm256_loadu_ps(values + j));
+				const int stop = scanMasks(_mm256_movemask_ps(_mm256_cmp_ps(d, mind8, _CMP_LE_OQ)), _mm256_movemask_ps(_mm256_cmp_ps(d, threshold8, _CMP_GT_OQ)), 8, j, lastMin);
+				if (stop < 8) return j + stop;
+			}
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		{
+			const __m128 h4 = _mm_set1_ps(h), mind4 = _mm_set1_ps(mind), threshold4 = _mm_set1_ps(threshold);
+			for (; j + 4 <= n; j += 4) {
+				const __m128 d = cost(h4, _mm_loadu_ps(values + j));
+				const int stop = scanMasks(_mm_movemask_ps(_mm_cmple_ps(d, mind4)), _mm_movemask_ps(_mm_cmpgt_ps(d, threshold4)), 4, j, lastMin);
+				if (stop < 4) return j + stop;
+			}
+		}
+#endif
+		for (; j < n; j++) {
+			const float d = cost(h, values[j]);
+			if (d > threshold) return j;
+			if (d <= mind) lastMin = j;
+		}
+		return n;
+	}
+
+	int scanDouble(const double* values, int n, double h, double mind, double threshold, int &lastMin) {
+		lastMin = -1;
+		int j = 0;
+#if SIMD_KERNELS_LEVEL >= 3
+		{
+			const __m512d h8 = _mm512_set1_pd(h), mind8 = _mm512_set1_pd(mind), threshold8 = _mm512_set1_pd(threshold);
+			for (; j + 8 <= n; j += 8) {
+				const __m512d d = cost(h8, _mm512_loadu_pd(values + j));
+				const int stop = scanMasks(_mm512_cmp_pd_mask(d, mind8, _CMP_LE_OQ), _mm512_cmp_pd_mask(d, threshold8, _CMP_GT_OQ), 8, j, lastMin);
+				if (stop < 8) return j + stop;
+			}
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 2
+		{
+			const __m256d h4 = _mm256_set1_pd(h), mind4 = _mm256_set1_pd(mind), threshold4 = _mm256_set1_pd(threshold);
+			for (; j + 4 <= n; j += 4) {
+				const __m256d d = cost(h4, _mm256_loadu_pd(values + j));
+				const int stop = scanMasks(_mm256_movemask_pd(_mm256_cmp_pd(d, mind4, _CMP_LE_OQ)), _mm256_movemask_pd(_mm256_cmp_pd(d, threshold4, _CMP_GT_OQ)), 4, j, lastMin);
+				if (stop < 4) return j + stop;
+			}
+		}
+#endif
+#if SIMD_KERNELS_LEVEL >= 1
+		{
+			const __m128d h2 = _mm_set1_pd(h), mind2 = _mm_set1_pd(mind), threshold2 = _mm_set1_pd(threshold);
+			for (; j + 2 <= n; j += 2) {
+				const __m128d d = cost(h2, _mm_loadu_pd(values + j));
+				const int stop = scanMasks(_mm_movemask_pd(_mm_cmple_pd(d, mind2)), _mm_movemask_pd(_mm_cmpgt_pd(d, threshold2)), 2, j, lastMin);
+				if (stop < 2) return j + stop;
+			}
+		}
+#endif
+		for (; j < n; j++) {
+			const double d = cost(h, values[j]);
+			if (d > threshold) return j;
+			if (d <= mind) lastMin = j;
+		}
+		return n;
+	}
+
+}
+
+extern const SimdKernelTable SIMD_KERNELS_TABLE;
+const SimdKernelTable SIMD_KERNELS_TABLE = {
+	SIMD_KERNELS_NAME,
+	projectFloat, projectDouble,
+	accumulateFloat, accumulateDouble,
+	advectFloat, advectDouble,
+	sumCostsFloat, sumCostsDouble,
+	scanFloat, scanDouble
+};
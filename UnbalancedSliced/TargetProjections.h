@@ -0,0 +1,125 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include "Directions.h"
+
+
+// Sorted 1D projections of a target point set along a sequence of directions.
+// Saved to a compact binary file so that the target projections and sorts can be
+// reused by every job sharing the same target.
+//
+// File layout (little endian):
+//   char[8]  magic "OTCTPROJ"
+//   uint32   version, dimension, number of directions, number of projections per direction
+//   uint64   seed of the directions (version 2, version 1 files were drawn with seed 10)
+//   uint32   schedule of the directions, DirectionSequence::Schedule (version 3, older
+//            files were drawn with the gaussian schedule, 0)
+//   float    directions (dimension values per direction)
+//   float    sorted projections (per direction)
+struct TargetProjections {
+
+	TargetProjections() : dim(0), nbDirections(0), nbProjections(0), seed(10), schedule(0) {};
+
+	// unit direction of the k-th slice
+	const float* direction(size_t k) const {
+		return &directions[k*dim];
+	}
+
+	// sorted projections of the target along the k-th direction
+	const float* projections(size_t k) const {
+		return &sorted[k*nbProjections];
+	}
+
+	void resize(uint32_t dimension, uint32_t nbDirs, uint32_t nbProjs) {
+		dim = dimension;
+		nbDirections = nbDirs;
+		nbProjections = nbProjs;
+		directions.resize((size_t)dim * nbDirections);
+		sorted.resize((size_t)nbProjections * nbDirections);
+	}
+
+	// returns false on I/O error
+	bool save(const std::string &filename) const {
+		std::ofstream ofs(filename, std::ofstream::binary);
+		if (!ofs) return false;
+		const uint32_t header[4] = { (uint32_t)VERSION, dim, nbDirections, nbProjections };
+		ofs.write(magic(), 8);
+		ofs.write((const char*)header, sizeof(header));
+		ofs.write((const char*)&seed, sizeof(seed));
+		ofs.write((const char*)&schedule, sizeof(schedule));
+		ofs.write((const char*)directions.data(), directions.size() * sizeof(float));
+		ofs.write((const char*)sorted.data(), sorted.size() * sizeof(float));
+		return (bool)ofs;
+	}
+
+	// returns false on I/O error or if the file is not a projection file (the sizes of
+	// the header are checked against the length of the file before any allocation)
+	bool load(const std::string &filename) {
+		std::ifstream ifs(filename, std::ifstream::binary | std::ifstream::ate);
+		if (!ifs) return false;
+		const uint64_t length = (uint64_t)ifs.tellg();
+		ifs.seekg(0);
+		if (!ifs) return false;
+		char tag[8];
+		uint32_t header[4];
+		ifs.read(tag, 8);
+		ifs.read((char*)header, sizeof(header));
+		if (!ifs || memcmp(tag, magic(), 8) != 0 || header[0] < 1 || header[0] > VERSION) return false;
+		seed = 10;
+		if (header[0] >= 2) ifs.read((char*)&seed, sizeof(seed));
+		schedule = 0;
+		if (header[0] >= 3) ifs.read((char*)&schedule, sizeof(schedule));
+		if (!ifs || schedule > DirectionSequence::QMC) return false;
+		// dimension + number of projections floats per direction
+		const uint64_t values = (length - (uint64_t)ifs.tellg()) / sizeof(float);
+		const uint64_t perDirection = (uint64_t)header[1] + header[3];
+		if (header[2] ? (values % header[2] != 0 || values / header[2] != perDirection) : values != 0) return false;
+		resize(header[1], header[2], header[3]);
+		ifs.read((char*)directions.data(), directions.size() * sizeof(float));
+		ifs.read((char*)sorted.data(), sorted.size() * sizeof(float));
+		return (bool)ifs;
+	}
+
+	uint32_t dim;
+	uint32_t nbDirections;
+	uint32_t nbProjections;
+	uint64_t seed;
+	uint32_t schedule;
+	std::vector<float> directions;
+	std::vector<float> sorted;
+
+	static const uint32_t VERSION = 3;
+	static const char* magic() { return "OTCTPROJ"; }
+};
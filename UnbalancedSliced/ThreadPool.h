@@ -0,0 +1,230 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+
+// Process-wide pool of worker threads.
+// Tasks are either submitted one by one (submit) or split into chunks processed
+// by the workers and the calling thread (parallelChunks, parallelFor).
+// Parallel loops started from a worker (or from inside another parallel loop)
+// run serially on the calling thread, so that nested parallelism never deadlocks
+// nor oversubscribes the machine.
+class ThreadPool {
+public:
+
+	// the process-wide pool (all cores by default)
+	static ThreadPool& instance() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	~ThreadPool() {
+		stop();
+	}
+
+	// sets the total number of threads (the calling thread included) ; 0 = all cores
+	void resize(unsigned int nbThreads) {
+		if (nbThreads == 0)
+			nbThreads = std::max(1u, std::thread::hardware_concurrency());
+		if (nbThreads == size()) return;
+		stop();
+		start(nbThreads);
+	}
+
+	// total number of threads working on a parallel loop
+	unsigned int size() const {
+		return (unsigned int)workers.size() + 1;
+	}
+
+	// true when called from a pool worker or from inside a parallel loop
+	static bool nested() {
+		return depth() > 0;
+	}
+
+	// runs f asynchronously on a worker ; without workers (or from a worker), f is run immediately
+	std::future<void> submit(const std::function<void()> &f) {
+		std::shared_ptr<std::packaged_task<void()> > task = std::make_shared<std::packaged_task<void()> >(f);
+		std::future<void> res = task->get_future();
+		if (workers.empty() || nested()) {
+			(*task)();
+			return res;
+		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			tasks.push_back([task] { (*task)(); });
+		}
+		cond.notify_one();
+		return res;
+	}
+
+	// calls f(chunk) for chunk in [0, nbChunks) on the pool and waits for completion
+	void parallelChunks(size_t nbChunks, const std::function<void(size_t)> &f) {
+		if (nbChunks == 0) return;
+		if (nbChunks == 1 || workers.empty() || nested()) {
+			for (size_t c = 0; c < nbChunks; c++) f(c);
+			return;
+		}
+
+		std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+		loop->f = &f;
+		loop->nbChunks = nbChunks;
+		loop->next = 0;
+		loop->done = 0;
+
+		size_t nbHelpers = std::min(nbChunks - 1, workers.size());
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (size_t i = 0; i < nbHelpers; i++)
+				tasks.push_back([loop] { loop->run(); });
+		}
+		cond.notify_all();
+
+		depth()++;
+		loop->run();
+		depth()--;
+
+		std::unique_lock<std::mutex> lock(loop->mutex);
+		loop->cond.wait(lock, [&loop] { return loop->done == loop->nbChunks; });
+	}
+
+	// calls f(begin, end) on contiguous ranges covering [0, n), one range per thread
+	// the partition only depends on n and on the pool size
+	void parallelFor(size_t n, const std::function<void(size_t, size_t)> &f, size_t minChunk = 4096) {
+		size_t nbChunks = std::max((size_t)1, std::min((size_t)size(), n / std::max((size_t)1, minChunk)));
+		if (nested()) nbChunks = 1;
+		size_t chunk = (n + nbChunks - 1) / nbChunks;
+		parallelChunks(nbChunks, [&](size_t c) {
+			size_t begin = std::min(n, c * chunk);
+			size_t end = std::min(n, begin + chunk);
+			if (begin < end) f(begin, end);
+		});
+	}
+
+	// sorts [first, last): one chunk per thread is sorted with std::sort, then the
+	// sorted runs are merged pairwise, the merges of a round running in parallel.
+	// For a strict total order (e.g. (value, index) pairs), the result is the one
+	// of std::sort whatever the number of threads.
+	template<typename It>
+	void parallelSort(It first, It last) {
+		const size_t n = last - first;
+		const size_t nbChunks = (n < (1 << 16) || nested()) ? 1 : size();
+		if (nbChunks == 1) {
+			std::sort(first, last);
+			return;
+		}
+		const size_t chunk = (n + nbChunks - 1) / nbChunks;
+		parallelChunks(nbChunks, [&](size_t c) {
+			std::sort(first + std::min(n, c * chunk), first + std::min(n, (c + 1) * chunk));
+		});
+		for (size_t width = chunk; width < n; width *= 2) {
+			parallelChunks((n + 2 * width - 1) / (2 * width), [&](size_t m) {
+				const size_t begin = m * 2 * width;
+				const size_t mid = std::min(n, begin + width), end = std::min(n, begin + 2 * width);
+				if (mid < end) std::inplace_merge(first + begin, first + mid, first + end);
+			});
+		}
+	}
+
+private:
+
+	struct Loop {
+		void run() {
+			size_t c;
+			while ((c = next++) < nbChunks) {
+				(*f)(c);
+				if (++done == nbChunks) {
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.notify_all();
+				}
+			}
+		}
+		const std::function<void(size_t)> *f;
+		size_t nbChunks;
+		std::atomic<size_t> next, done;
+		std::mutex mutex;
+		std::condition_variable cond;
+	};
+
+	ThreadPool() : stopping(false) {
+		start(std::max(1u, std::thread::hardware_concurrency()));
+	}
+
+	static int& depth() {
+		static thread_local int d = 0;
+		return d;
+	}
+
+	void start(unsigned int nbThreads) {
+		stopping = false;
+		for (unsigned int i = 1; i < nbThreads; i++) {
+			workers.push_back(std::thread([this] {
+				depth() = 1;
+				for (;;) {
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						cond.wait(lock, [this] { return stopping || !tasks.empty(); });
+						if (stopping && tasks.empty()) return;
+						task = tasks.front();
+						tasks.pop_front();
+					}
+					task();
+				}
+			}));
+		}
+	}
+
+	void stop() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cond.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool stopping;
+};
@@ -0,0 +1,569 @@
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "TransferContext.h"
+
+#include <algorithm>
+#include <iostream>
+#include "ThreadPool.h"
+#include "SimdKernels.h"
+#include "Directions.h"
+#include "QuantileFunction.h"
+#include "Profiler.h"
+
+
+// n indices drawn uniformly in [0, N) (with replacement) from the Philox blocks of
+// counter (k, j, stream), so that the samples of a direction only depend on (seed, k)
+static void sampleIndices(uint64_t seed, uint64_t k, uint32_t stream, size_t N, size_t n, unsigned int *indices) {
+	for (size_t j = 0; j < n; j += 4) {
+		const uint32_t counter[4] = { (uint32_t)k, (uint32_t)(k >> 32), (uint32_t)(j / 4), stream };
+		uint32_t out[4];
+		Philox4x32::block(counter, seed, out);
+		for (size_t i = j; i < std::min(n, j + 4); i++)
+			indices[i] = (unsigned int)(((uint64_t)out[i - j] * N) >> 32);
+	}
+}
+
+
+void TransferContext::slice(const float* const* source, size_t N, const float* const* target, size_t M, const float *dir,
+	uint64_t k, const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp) {
+
+	Profiler::Scope sliceScope("slice", true);
+	ThreadPool &pool = ThreadPool::instance();
+	float *projsource = buffers.projsource.data();
+	unsigned int *idSource = buffers.idSource.data();
+
+	// projection of the source
+	{
+		Profiler::Scope scope("projection");
+		pool.parallelFor(N, [&](size_t begin, size_t end) {
+			projectPlanar(source, dir, 3, begin, end, projsource);
+		});
+	}
+
+	if (params.sampleFraction < 1.0) {
+		sampledSlice(target, N, M, dir, k, sortedTarget, params, buffers, disp);
+		return;
+	}
+	if (params.useHistogram) {
+		histogramSlice(target, N, M, dir, sortedTarget, params, buffers, disp);
+		return;
+	}
+
+	if (!sortedTarget) {
+		float *projtarget = buffers.projtarget.data();
+		{
+			Profiler::Scope scope("projection");
+			pool.parallelFor(M, [&](size_t begin, size_t end) {
+				projectPlanar(target, dir, 3, begin, end, projtarget);
+			});
+		}
+
+		if ((N == M) && (params.nbQuantiles == 0)) {
+			// 1D optimal transport of the projections with two sorts
+			unsigned int *idTarget = buffers.idTarget.data();
+			{
+				Profiler::Scope scope("sort");
+				if (params.useStdSort) {
+					// sorts start from the identity so that ties do not depend on the scheduling
+					for (size_t i = 0; i < N; i++) {
+						idSource[i] = (unsigned int)i;
+						idTarget[i] = (unsigned int)i;
+					}
+					auto taskA = pool.submit([&] { std::sort(idSource, idSource + N, [projsource](unsigned int a, unsigned int b) { return projsource[a] < projsource[b]; }); });
+					std::sort(idTarget, idTarget + N, [projtarget](unsigned int a, unsigned int b) { return projtarget[a] < projtarget[b]; });
+					taskA.wait();
+				} else {
+					buffers.sorter.argsort(projsource, idSource, N);
+					buffers.sorter.argsort(projtarget, idTarget, N);
+				}
+			}
+
+			// 1D displacements
+			Profiler::Scope matchingScope("matching");
+			pool.parallelFor(N, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+					disp[idSource[i]] = projtarget[idTarget[i]] - projsource[idSource[i]];
+			});
+			return;
+		}
+
+		// only the sorted values of the target are needed
+		Profiler::Scope scope("sort");
+		if (params.useStdSort)
+			std::sort(projtarget, projtarget + M);
+		else
+			buffers.sorter.sort(projtarget, buffers.idTarget.data(), M);
+		sortedTarget = projtarget;
+	}
+
+	// quantile function of the target
+	const float *knots = sortedTarget;
+	size_t K = M;
+	if ((params.nbQuantiles > 0) && (params.nbQuantiles != M)) {
+		Profiler::Scope scope("matching");
+		buffers.knots.resize(params.nbQuantiles);
+		sampleQuantiles(sortedTarget, M, buffers.knots.data(), params.nbQuantiles);
+		knots = buffers.knots.data();
+		K = params.nbQuantiles;
+	}
+
+	{
+		Profiler::Scope scope("sort");
+		if (params.useStdSort) {
+			for (size_t i = 0; i < N; i++)
+				idSource[i] = (unsigned int)i;
+			std::sort(idSource, idSource + N, [projsource](unsigned int a, unsigned int b) { return projsource[a] < projsource[b]; });
+		} else
+			buffers.sorter.argsort(projsource, idSource, N);
+	}
+
+	// 1D displacements (source rank i -> target quantile)
+	Profiler::Scope matchingScope("matching");
+	pool.parallelFor(N, [&](size_t begin, size_t end) {
+		if (K == N)
+			for (size_t i = begin; i < end; i++)
+				disp[idSource[i]] = knots[i] - projsource[idSource[i]];
+		else
+			for (size_t i = begin; i < end; i++)
+				disp[idSource[i]] = quantileAtRank(knots, K, i, N) - projsource[idSource[i]];
+	});
+}
+
+
+void TransferContext::histogramSlice(const float* const* target, size_t N, size_t M, const float *dir,
+	const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp) {
+
+	ThreadPool &pool = ThreadPool::instance();
+	const float *projsource = buffers.projsource.data();
+	unsigned int *idSource = buffers.idSource.data();
+
+	if (!sortedTarget) {
+		float *projtarget = buffers.projtarget.data();
+		{
+			Profiler::Scope scope("projection");
+			pool.parallelFor(M, [&](size_t begin, size_t end) {
+				projectPlanar(target, dir, 3, begin, end, projtarget);
+			});
+		}
+		// only the CDF of the target is needed
+		Profiler::Scope scope("sort");
+		buffers.histTarget.histogram(projtarget, M, params.histogramBins);
+	}
+
+	{
+		Profiler::Scope scope("sort");
+		buffers.histSource.argsort(projsource, N, params.histogramBins, idSource);
+	}
+
+	// 1D displacements (source rank r -> target quantile, by CDF inversion)
+	Profiler::Scope matchingScope("matching");
+	const double rankScale = (N > 1) ? (double)(M - 1) / (double)(N - 1) : 0.0;
+	const HistogramSorter<float> &histTarget = buffers.histTarget;
+	pool.parallelFor(N, [&](size_t begin, size_t end) {
+		if (sortedTarget) {
+			for (size_t r = begin; r < end; r++)
+				disp[idSource[r]] = quantileAtRank(sortedTarget, M, r, N) - projsource[idSource[r]];
+			return;
+		}
+		size_t bin = histTarget.findBin(begin * rankScale);
+		for (size_t r = begin; r < end; r++)
+			disp[idSource[r]] = histTarget.quantile(r * rankScale, bin) - projsource[idSource[r]];
+	});
+}
+
+
+void TransferContext::sampledSlice(const float* const* target, size_t N, size_t M, const float *dir, uint64_t k,
+	const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp) {
+
+	ThreadPool &pool = ThreadPool::instance();
+	const size_t m = std::min(N, std::max((size_t)2, (size_t)(params.sampleFraction * N + 0.5)));
+	buffers.sampleSource.resize(m);
+	buffers.sampleTarget.resize(m);
+	buffers.idSample.resize(m);
+	const float *projsource = buffers.projsource.data();
+	float *sampleSource = buffers.sampleSource.data();
+	float *sampleTarget = buffers.sampleTarget.data();
+	unsigned int *idSample = buffers.idSample.data();
+
+	{
+		Profiler::Scope scope("projection");
+		sampleIndices(params.seed, k, 2, N, m, idSample);
+		for (size_t j = 0; j < m; j++)
+			sampleSource[j] = projsource[idSample[j]];
+		if (!sortedTarget) {
+			sampleIndices(params.seed, k, 3, M, m, idSample);
+			for (size_t j = 0; j < m; j++) {
+				const unsigned int pix = idSample[j];
+				sampleTarget[j] = dir[0] * target[0][pix] + dir[1] * target[1][pix] + dir[2] * target[2][pix];
+			}
+		}
+	}
+
+	{
+		Profiler::Scope scope("sort");
+		if (params.useStdSort) {
+			std::sort(sampleSource, sampleSource + m);
+			if (!sortedTarget) std::sort(sampleTarget, sampleTarget + m);
+		} else {
+			buffers.sorter.sort(sampleSource, idSample, m);
+			if (!sortedTarget) buffers.sorter.sort(sampleTarget, idSample, m);
+		}
+		// the precomputed projections are already sorted
+		if (sortedTarget) sampleQuantiles(sortedTarget, M, sampleTarget, m);
+	}
+
+	// 1D map sampleSource[j] -> sampleTarget[j], linearly interpolated and tabulated on
+	// a uniform grid over the range of the source samples, so that evaluating it at a
+	// projection does not depend on the distribution of the samples
+	Profiler::Scope matchingScope("matching");
+	const float lo = sampleSource[0], hi = sampleSource[m - 1];
+	// a single sample (N = 1): the map is a translation
+	if (m < 2) {
+		for (size_t i = 0; i < N; i++)
+			disp[i] = sampleTarget[0] - lo;
+		return;
+	}
+	const size_t G = MAP_CELLS;
+	const double cellSize = (hi > lo) ? (double)(hi - lo) / G : 1.0;
+	buffers.sampleMap.resize(G + 1);
+	float *map = buffers.sampleMap.data();
+	for (size_t c = 0, j = 0; c <= G; c++) {
+		const double x = std::min((double)hi, lo + c * cellSize);
+		while ((j + 2 < m) && (sampleSource[j + 1] <= x)) j++;
+		const double s0 = sampleSource[j], s1 = sampleSource[j + 1];
+		const double t = (s1 > s0) ? std::min(1.0, std::max(0.0, (x - s0) / (s1 - s0))) : 1.0;
+		map[c] = (float)((1.0 - t) * sampleTarget[j] + t * sampleTarget[j + 1]);
+	}
+	// beyond the extreme samples, the map is a translation
+	const float below = sampleTarget[0] - lo, above = sampleTarget[m - 1] - hi;
+	const float scale = (float)(1.0 / cellSize);
+	pool.parallelFor(N, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const float p = projsource[i];
+			if (p <= lo)
+				disp[i] = below;
+			else if (p >= hi)
+				disp[i] = above;
+			else {
+				const float x = (p - lo) * scale;
+				const size_t c = std::min(G - 1, (size_t)x);
+				const float t = x - (float)c;
+				disp[i] = (1.0f - t) * map[c] + t * map[c + 1] - p;
+			}
+		}
+	});
+}
+
+
+int TransferContext::slicedTransfer(float* const* source, size_t N, const float* const* target, size_t M,
+	const TransferParameters &params, const TargetProjections *targetProj) {
+
+	// random generator init to draw random line directions
+	DirectionSequence directionSequence(3, params.seed, params.directions);
+	ThreadPool &pool = ThreadPool::instance();
+	const int batchSize = params.batchSize;
+	const size_t nbTarget = targetProj ? targetProj->nbProjections : M;
+
+	// each direction of a batch has its own displacement buffer. When the batch has
+	// at least as many directions as threads, rounds of one direction per thread are
+	// processed concurrently (one slot of working buffers per thread) ; the remaining
+	// directions (all of them for smaller batches) are processed one after another,
+	// each one using all the threads in its projections and sorts
+	const int nbSlots = (batchSize >= (int)pool.size()) ? (int)pool.size() : 1;
+	const int nbConcurrent = (nbSlots > 1) ? batchSize - batchSize % nbSlots : 0;
+	if ((int)slots.size() < nbSlots) slots.resize(nbSlots);
+	for (int s = 0; s < nbSlots; s++) {
+		slots[s].projsource.resize(N);
+		// the sampled directions do not sort whole images
+		if (params.sampleFraction < 1.0) continue;
+		slots[s].idSource.resize(N);
+		if (!targetProj) {
+			slots[s].projtarget.resize(M);
+			slots[s].idTarget.resize(M);
+		}
+	}
+	if ((int)disp.size() < batchSize) disp.resize(batchSize);
+	for (int batch = 0; batch < batchSize; batch++)
+		disp[batch].resize(N);
+	directions.resize(3 * batchSize);
+	sortedTargets.assign(batchSize, NULL);
+	advect.resize(3 * N);
+	stepDistances.clear();
+	StepBudget budget(params.timeBudget);
+
+	// the accumulation runs on fixed blocks, so that the sum of the squared
+	// displacements does not depend on the number of threads
+	const size_t blockSize = 1 << 16;
+	const size_t nbBlocks = (N + blockSize - 1) / blockSize;
+	std::vector<double> blockSums(nbBlocks);
+
+	for (int step = 0; step < params.nbSteps; step++) {
+		auto stepStart = std::chrono::steady_clock::now();
+		for (int batch = 0; batch < batchSize; batch++) {
+			float *dir = &directions[3 * batch];
+			if (targetProj) {
+				const size_t k = step * batchSize + batch;
+				std::copy(targetProj->direction(k), targetProj->direction(k) + 3, dir);
+				sortedTargets[batch] = targetProj->projections(k);
+			} else
+				directionSequence.next(dir);
+			if (params.verbose) std::cout << "Slice " << step << " batch " << batch << "  " << dir[0] << "," << dir[1] << "," << dir[2] << std::endl;
+		}
+
+		if (nbConcurrent > 0) {
+			pool.parallelChunks(nbSlots, [&](size_t slot) {
+				for (size_t batch = slot; batch < (size_t)nbConcurrent; batch += nbSlots)
+					slice(source, N, target, nbTarget, &directions[3 * batch], (uint64_t)step * batchSize + batch, sortedTargets[batch], params, slots[slot], disp[batch].data());
+			});
+		}
+		for (int batch = nbConcurrent; batch < batchSize; batch++)
+			slice(source, N, target, nbTarget, &directions[3 * batch], (uint64_t)step * batchSize + batch, sortedTargets[batch], params, slots[0], disp[batch].data());
+
+		// the displacements of the batch are accumulated in the batch order (so that the
+		// result does not depend on the number of threads) before the advection
+		pool.parallelChunks(nbBlocks, [&](size_t block) {
+			const size_t begin = block * blockSize, end = std::min(N, begin + blockSize);
+			{
+				Profiler::Scope scope("accumulation");
+				for (int k = 0; k < 3; k++) {
+					std::fill(advect.data() + k * N + begin, advect.data() + k * N + end, 0.0f);
+					for (int batch = 0; batch < batchSize; batch++)
+						accumulateDisplacement(advect.data() + k * N, disp[batch].data(), directions[3 * batch + k], begin, end);
+				}
+				double sum = 0.0;
+				for (int batch = 0; batch < batchSize; batch++) {
+					const float *d = disp[batch].data();
+					for (size_t i = begin; i < end; i++)
+						sum += (double)d[i] * d[i];
+				}
+				blockSums[block] = sum;
+			}
+			Profiler::Scope scope("advection");
+			for (int k = 0; k < 3; k++)
+				advectPlanar(source[k], advect.data() + k * N, params.factor, (float)batchSize, begin, end);
+		});
+
+		// sliced Wasserstein estimate of the step (before its advection)
+		double sum = 0.0;
+		for (size_t block = 0; block < nbBlocks; block++)
+			sum += blockSums[block];
+		stepDistances.push_back(sqrt(sum / ((double)N * batchSize)));
+		if (params.verbose) std::cout << "Step " << step << "  SW " << stepDistances.back() << std::endl;
+		if (endStep(params, budget, stepStart))
+			break;
+	}
+	return (int)stepDistances.size();
+}
+
+
+bool TransferContext::converged(const TransferParameters &params) const {
+	// windows of steps covering CONVERGENCE_DIRECTIONS directions
+	const size_t window = (CONVERGENCE_DIRECTIONS + params.batchSize - 1) / params.batchSize;
+	return slicedFlowConverged(stepDistances, window, params.tolerance);
+}
+
+
+bool TransferContext::endStep(const TransferParameters &params, StepBudget &budget, std::chrono::steady_clock::time_point stepStart) const {
+	budget.addStep(std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count());
+	if (converged(params) || budget.exhausted())
+		return true;
+	// no intermediate result once the flow stops, the caller exports the final one
+	const int steps = (int)stepDistances.size();
+	if (params.progress && (params.progressSteps > 0) && (steps % params.progressSteps == 0) && (steps < params.nbSteps))
+		params.progress(steps);
+	return budget.exhausted();
+}
+
+
+int TransferContext::slicedTransfer(float* source, size_t N, const float* target, size_t M,
+	const TransferParameters &params, const TargetProjections *targetProj) {
+	float *sourceChannels[3] = { source, source + N, source + 2 * N };
+	const float *targetChannels[3] = { target, target ? target + M : NULL, target ? target + 2 * M : NULL };
+	return slicedTransfer(sourceChannels, N, targetChannels, M, params, targetProj);
+}
+
+
+void TransferContext::precomputeTarget(const float* const* target, size_t M, uint32_t nbDirections, size_t nbQuantiles,
+	TargetProjections &projections, uint64_t seed, DirectionSequence::Schedule schedule) {
+
+	ThreadPool &pool = ThreadPool::instance();
+	const size_t K = (nbQuantiles > 0) ? nbQuantiles : M;
+	projections.resize(3, nbDirections, (uint32_t)K);
+	projections.seed = seed;
+	projections.schedule = (uint32_t)schedule;
+
+	if (slots.empty()) slots.resize(1);
+	SliceBuffers &buffers = slots[0];
+	buffers.projtarget.resize(M);
+	buffers.idTarget.resize(M);
+	buffers.knots.resize(M);
+	float *proj = buffers.projtarget.data();
+	float *sorted = buffers.knots.data();
+
+	DirectionSequence directionSequence(3, seed, schedule);
+	for (uint32_t k = 0; k < nbDirections; k++) {
+		float *dir = &projections.directions[3 * k];
+		directionSequence.next(dir);
+		pool.parallelFor(M, [&](size_t begin, size_t end) {
+			projectPlanar(target, dir, 3, begin, end, proj);
+		});
+		if (K == M)
+			buffers.sorter.argsort(proj, buffers.idTarget.data(), M, &projections.sorted[k * K]);
+		else {
+			buffers.sorter.argsort(proj, buffers.idTarget.data(), M, sorted);
+			sampleQuantiles(sorted, M, &projections.sorted[k * K], K);
+		}
+	}
+}
+
+
+int TransferContext::slicedTransferWeighted(float* const* source, const float* sourceWeights, size_t N,
+	const float* const* target, const float* targetWeights, size_t M, const TransferParameters &params) {
+
+	// random generator init to draw random line directions
+	DirectionSequence directionSequence(3, params.seed, params.directions);
+	ThreadPool &pool = ThreadPool::instance();
+
+	// masses are normalized so that both sets have unit total mass
+	double totalSource = 0.0, totalTarget = 0.0;
+	for (size_t i = 0; i < N; i++) totalSource += sourceWeights[i];
+	for (size_t i = 0; i < M; i++) totalTarget += targetWeights[i];
+
+	if (slots.empty()) slots.resize(1);
+	SliceBuffers &buffers = slots[0];
+	buffers.projsource.resize(N);
+	buffers.projtarget.resize(M);
+	buffers.idSource.resize(N);
+	buffers.idTarget.resize(M);
+	if (disp.empty()) disp.resize(1);
+	disp[0].resize(N);
+	advect.resize(3 * N);
+	std::fill(advect.data(), advect.data() + 3 * N, 0.0f);
+
+	float *projsource = buffers.projsource.data();
+	float *projtarget = buffers.projtarget.data();
+	unsigned int *idSource = buffers.idSource.data();
+	unsigned int *idTarget = buffers.idTarget.data();
+	float *displacement = disp[0].data();
+
+	// the permutations are kept from one slice to the next
+	for (size_t i = 0; i < N; i++)
+		idSource[i] = (unsigned int)i;
+	for (size_t i = 0; i < M; i++)
+		idTarget[i] = (unsigned int)i;
+	stepDistances.clear();
+	StepBudget budget(params.timeBudget);
+
+	for (int step = 0; step < params.nbSteps; step++) {
+		auto stepStart = std::chrono::steady_clock::now();
+		double sum = 0.0;
+		for (int batch = 0; batch < params.batchSize; batch++) {
+			float dir[3];
+			directionSequence.next(dir);
+			if (params.verbose) std::cout << "Slice " << step << " batch " << batch << "  " << dir[0] << "," << dir[1] << "," << dir[2] << std::endl;
+			Profiler::Scope sliceScope("slice", true);
+
+			{
+				Profiler::Scope scope("projection");
+				pool.parallelFor(N, [&](size_t begin, size_t end) {
+					projectPlanar(source, dir, 3, begin, end, projsource);
+				});
+				pool.parallelFor(M, [&](size_t begin, size_t end) {
+					projectPlanar(target, dir, 3, begin, end, projtarget);
+				});
+			}
+
+			{
+				Profiler::Scope scope("sort");
+				if (params.useStdSort) {
+					auto taskA = pool.submit([&] { std::sort(idSource, idSource + N, [projsource](unsigned int a, unsigned int b) { return projsource[a] < projsource[b]; }); });
+					std::sort(idTarget, idTarget + M, [projtarget](unsigned int a, unsigned int b) { return projtarget[a] < projtarget[b]; });
+					taskA.wait();
+				} else {
+					buffers.sorter.argsort(projsource, idSource, N);
+					buffers.sorter.argsort(projtarget, idTarget, M);
+				}
+			}
+
+			// weighted 1D quantile matching: sweep of both cumulative mass functions
+			{
+				Profiler::Scope scope("matching");
+				size_t j = 0;
+				double startTarget = 0.0; // mass before idTarget[j]
+				double endTarget = targetWeights[idTarget[0]] / totalTarget;
+				double startSource = 0.0;
+				for (size_t i = 0; i < N; i++) {
+					const unsigned int col = idSource[i];
+					const double endSource = (i == N - 1) ? 1.0 : startSource + sourceWeights[col] / totalSource;
+					double mean = 0.0;
+					double lower = startSource;
+					while (lower < endSource) {
+						const double upper = std::min(endSource, endTarget);
+						mean += (upper - lower) * projtarget[idTarget[j]];
+						lower = upper;
+						if ((endTarget <= endSource) && (j < M - 1)) {
+							j++;
+							startTarget = endTarget;
+							endTarget = (j == M - 1) ? 1.0 : startTarget + targetWeights[idTarget[j]] / totalTarget;
+						} else
+							break;
+					}
+					mean /= (endSource - startSource);
+					startSource = endSource;
+
+					displacement[col] = mean - projsource[col];
+					sum += sourceWeights[col] / totalSource * displacement[col] * displacement[col];
+				}
+			}
+
+			// the displacements are accumulated in a batch
+			Profiler::Scope accumulationScope("accumulation");
+			for (int k = 0; k < 3; k++)
+				accumulateDisplacement(advect.data() + k * N, displacement, dir[k], 0, N);
+		}
+
+		// advection
+		Profiler::Scope scope("advection");
+		pool.parallelFor(3 * N, [&](size_t begin, size_t end) {
+			for (int k = 0; k < 3; k++) {
+				// the planar advection buffer is split along the channels
+				const size_t b = std::max(begin, k * N), e = std::min(end, (k + 1) * N);
+				if (b < e) advectPlanar(source[k] + (b - k * N), advect.data() + b, params.factor, (float)params.batchSize, 0, e - b);
+			}
+			std::fill(advect.data() + begin, advect.data() + end, 0.0f);
+		});
+
+		stepDistances.push_back(sqrt(sum / params.batchSize));
+		if (params.verbose) std::cout << "Step " << step << "  SW " << stepDistances.back() << std::endl;
+		if (endStep(params, budget, stepStart))
+			break;
+	}
+	return (int)stepDistances.size();
+}
@@ -0,0 +1,209 @@
+#pragma once
+/*
+  Copyright (c) 2019 CNRS
+  Nicolas Bonneel <nicolas.bonneel@liris.cnrs.fr>
+  David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Reusable entry point of the transfer engines (libotct).
+// A TransferContext owns the working buffers of the balanced sliced transfer and of the
+// partial sliced transport (UnbalancedSliced). They are allocated by the first call and
+// reused (grown when needed) by the next ones, so that a long-running process does not
+// allocate per job. Pixel buffers are owned by the caller and transported in place.
+// A context must not be used by several threads at once: use one context per concurrent
+// job (the engines themselves run on the ThreadPool).
+
+#include <vector>
+#include <functional>
+#include "UnbalancedSliced.h"
+#include "AlignedBuffer.h"
+#include "RadixSort.h"
+#include "TargetProjections.h"
+#include "HistogramMatching.h"
+
+
+// parameters of the balanced sliced transfer
+struct TransferParameters {
+	// bins of the histogram matcher: steps below 0.01 over the range of the projections of 8-bit colors (2 * 255 * sqrt(3))
+	static const size_t DEFAULT_HISTOGRAM_BINS = 1 << 17;
+
+	TransferParameters() : nbSteps(3), batchSize(1), factor(1.0), nbQuantiles(0), seed(DirectionSequence::DEFAULT_SEED), directions(DirectionSequence::GAUSSIAN), tolerance(0.0), timeBudget(0.0), progressSteps(0), sampleFraction(1.0), useHistogram(false), histogramBins(DEFAULT_HISTOGRAM_BINS), useStdSort(false), computeDistances(true), verbose(false) {}
+
+	int nbSteps;        // number of advection steps (maximal number if tolerance > 0)
+	int batchSize;      // number of directions per step
+	double factor;      // displacement factor in [0, 1]
+	size_t nbQuantiles; // number of quantile knots of the target projections (0 = all of them)
+	uint64_t seed;      // seed of the random directions (see DirectionSequence)
+	DirectionSequence::Schedule directions; // schedule of the directions
+	double tolerance;   // the flow stops when the relative improvement of the sliced Wasserstein estimate falls below it (0 = nbSteps steps, see slicedTransfer)
+	double timeBudget;  // the flow stops before the step that would exceed this duration in seconds (0 = no budget, see slicedTransfer)
+	int progressSteps;  // progress is called every progressSteps steps but the last one (0 = never)
+	std::function<void(int)> progress; // called with the number of steps performed, the source holding the current result
+	double sampleFraction; // fraction of the pixels sampled by each direction (1 = all of them, see slicedTransfer)
+	bool useHistogram;  // approximate 1D matching by counting sorts on histogramBins bins (see slicedTransfer)
+	size_t histogramBins;
+	bool useStdSort;    // std::sort instead of the radix sort for the 1D problems
+	bool computeDistances; // false: the advected partial transport skips the costs of its 1D problems (see correspondencesNd)
+	bool verbose;       // prints the directions on std::cout
+};
+
+
+class TransferContext {
+public:
+
+	TransferContext() {}
+	TransferContext(const TransferContext&) = delete;
+	TransferContext& operator=(const TransferContext&) = delete;
+
+	// Balanced sliced transfer of the first three channels of planar images: source[k]
+	// (N values) and target[k] (M values) point to the k-th channel. The source is
+	// advected in place.
+	// With targetProj, the directions and the sorted target projections are read from
+	// the precomputed file instead of being computed from target (which may be NULL).
+	// When the two sizes differ, or with params.nbQuantiles > 0, the sorted target
+	// projections are seen as a piecewise-linear quantile function and the source ranks
+	// are mapped through it.
+	// Each step measures the sliced Wasserstein distance between the source and the
+	// target along its directions (root mean square of the 1D displacements, see
+	// distances()). With params.tolerance > 0, the flow stops as soon as the distance
+	// estimated on the last steps covering 16 directions improves by less than
+	// params.tolerance (relative) on the one of the 16 previous directions.
+	// With params.timeBudget > 0, the flow also stops before the first step expected to
+	// end after the budget (see StepBudget), at least one step being performed. The time
+	// spent in params.progress is not counted in the duration of the steps.
+	// With params.sampleFraction < 1, each direction only sorts m = sampleFraction * N
+	// source pixels and m target quantiles (projections of m target pixels, or samples of
+	// the precomputed sorted projections), the pixels being drawn from (seed, direction
+	// index). The 1D map between the two samples is interpolated to displace every pixel
+	// (translated beyond the extreme samples), so that a direction costs O(N + m log m)
+	// instead of O(N log N).
+	// With params.useHistogram, the source projections are ordered by a counting sort on
+	// params.histogramBins bins over their range, and source rank r is mapped to the
+	// quantile of rank r (M - 1) / (N - 1) of the target, obtained by inverting its
+	// cumulative histogram (or read from the precomputed projections). A direction costs
+	// O(N + M + histogramBins), the displacements being exact up to the bin widths.
+	// params.nbQuantiles is then ignored.
+	// Returns the number of steps performed. The result does not depend on the number
+	// of threads of the pool.
+	int slicedTransfer(float* const* source, size_t N, const float* const* target, size_t M,
+		const TransferParameters &params, const TargetProjections *targetProj = NULL);
+
+	// same, for contiguous planar buffers (channel k starting at k * N, resp. k * M)
+	int slicedTransfer(float* source, size_t N, const float* target, size_t M,
+		const TransferParameters &params, const TargetProjections *targetProj = NULL);
+
+	// Sorted projections of a planar RGB target (M pixels) along the first nbDirections
+	// directions drawn by slicedTransfer with the given seed and schedule, reduced to
+	// nbQuantiles knots per direction if nbQuantiles > 0 (see TargetProjections).
+	void precomputeTarget(const float* const* target, size_t M, uint32_t nbDirections, size_t nbQuantiles,
+		TargetProjections &projections, uint64_t seed = DirectionSequence::DEFAULT_SEED,
+		DirectionSequence::Schedule schedule = DirectionSequence::GAUSSIAN);
+
+	// Sliced transfer of weighted planar point sets (e.g. unique colors): each 1D problem
+	// is solved by matching the quantile functions of the two weighted projections, a
+	// source point being moved to the mean target projection over the mass interval it
+	// covers. params.nbQuantiles is ignored. Same stopping criterion and returned value
+	// as slicedTransfer, the distances being weighted by the source masses.
+	int slicedTransferWeighted(float* const* source, const float* sourceWeights, size_t N,
+		const float* const* target, const float* targetWeights, size_t M, const TransferParameters &params);
+
+	// Partial sliced transport of cloud1 into cloud2 (cloud1.size() <= cloud2.size()),
+	// see UnbalancedSliced::correspondencesNd, with params.nbSteps slices (at most, with
+	// params.tolerance > 0 or params.timeBudget > 0), params.progress being called every
+	// params.progressSteps slices, with the approximate slices of UnbalancedSliced if
+	// params.useHistogram. params.batchSize, factor and nbQuantiles are ignored.
+	// cloud1 is advected in place if advect is true. The sliced Wasserstein estimates of
+	// the slices are given by unbalanced().distances() (not computed when advecting with
+	// params.computeDistances false and no tolerance).
+	template<int DIM, typename T>
+	double correspondencesNd(std::vector<Point<DIM, T> > &cloud1, const std::vector<Point<DIM, T> > &cloud2, const TransferParameters &params, bool advect = false) {
+		partial.useRadixSort = !params.useStdSort;
+		partial.useHistogram = params.useHistogram;
+		partial.histogramBins = params.histogramBins;
+		partial.seed = params.seed;
+		partial.directions = params.directions;
+		partial.tolerance = params.tolerance;
+		partial.computeDistances = params.computeDistances;
+		partial.timeBudget = params.timeBudget;
+		partial.progressSlices = params.progressSteps;
+		partial.progress = params.progress;
+		return partial.correspondencesNd(cloud1, cloud2, params.nbSteps, advect);
+	}
+
+	// sliced Wasserstein estimates of the steps of the last sliced transfer, each one
+	// being measured before the advection of its step
+	const std::vector<double>& distances() const { return stepDistances; }
+
+	// the partial transport engine (for its other entry points)
+	UnbalancedSliced& unbalanced() { return partial; }
+
+private:
+
+	// working buffers of the 1D problem of one direction
+	struct SliceBuffers {
+		AlignedBuffer<float> projsource, projtarget;
+		AlignedBuffer<unsigned int> idSource, idTarget;
+		AlignedBuffer<float> knots; // quantile knots of the target projections
+		AlignedBuffer<float> sampleSource, sampleTarget; // sorted projections of the sampled pixels
+		AlignedBuffer<unsigned int> idSample;
+		AlignedBuffer<float> sampleMap; // 1D map between the samples, on a uniform grid
+		HistogramSorter<float> histSource, histTarget;
+		RadixSorter<float> sorter;
+	};
+
+	// projects, sorts and matches the source and target along dir, the k-th direction of
+	// the flow ; disp[pix] receives the 1D displacement of the source pixel pix
+	void slice(const float* const* source, size_t N, const float* const* target, size_t M, const float *dir,
+		uint64_t k, const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp);
+
+	// same, with params.useHistogram (the source being projected in projsource)
+	void histogramSlice(const float* const* target, size_t N, size_t M, const float *dir,
+		const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp);
+
+	// same, with params.sampleFraction < 1 : the 1D map between the samples of the k-th
+	// direction is interpolated at the projections of all the source pixels (projsource)
+	void sampledSlice(const float* const* target, size_t N, size_t M, const float *dir, uint64_t k,
+		const float *sortedTarget, const TransferParameters &params, SliceBuffers &buffers, float *disp);
+
+	// true if the last steps improved the sliced Wasserstein estimate by less than the tolerance
+	bool converged(const TransferParameters &params) const;
+	static const int CONVERGENCE_DIRECTIONS = 16;
+	static const size_t MAP_CELLS = 1 << 16; // resolution of the tabulated 1D maps of the sampled directions
+
+	// end of a step started at stepStart: records its duration in budget, calls the
+	// progress callback when due, and returns true if the flow must stop (convergence
+	// or exhausted budget)
+	bool endStep(const TransferParameters &params, StepBudget &budget, std::chrono::steady_clock::time_point stepStart) const;
+
+	std::vector<SliceBuffers> slots;             // one per concurrent direction of a batch
+	std::vector<AlignedBuffer<float> > disp;     // 1D displacements, one per direction of a batch
+	AlignedBuffer<float> advect;                 // accumulated displacements (planar)
+	std::vector<float> directions;
+	std::vector<const float*> sortedTargets;
+	std::vector<double> stepDistances;
+	UnbalancedSliced partial;
+};
@@ -33,6 +33,7 @@
 #include <algorithm>
 #include <utility>
 #include <chrono>
+#include <functional>
 #include <ctime>
 #include <cstring>
 #include <cmath>
@@ -43,6 +44,13 @@
 #define cimg_display 0
 #include "CImg.h"
 #include "Point.h"
+#include "ThreadPool.h"
+#include "RadixSort.h"
+#include "AlignedBuffer.h"
+#include "Profiler.h"
+#include "Directions.h"
+#include "HistogramMatching.h"
+#include "SimdKernels.h"
 
 #ifdef _MSC_VER
   #include <intrin.h>
@@ -60,10 +68,6 @@
 
 float cost(float x, float y);
 double cost(double x, double y);
-__m256 cost(const __m256 &x, const __m256 &y);
-__m256d cost(const __m256d &x, const __m256d &y);
-double sumCosts(const double* h1, int start1, const double* h2, int start2, int n);
-float sumCosts(const float* h1, int start1, const float* h2, int start2, int n);
 void * malloc_simd(const size_t size, const size_t alignment);
 void free_simd(void* mem);
 
@@ -74,25 +78,52 @@ struct params {
 };
 
 
-#ifdef __APPLE__
-static std::default_random_engine engine(10); // 10 = random seed
-static std::uniform_real_distribution<double> uniform(0, 1);
-#else
-static thread_local std::default_random_engine engine(10); // 10 = random seed
-static thread_local std::uniform_real_distribution<double> uniform(0, 1);
-#endif
+// Stopping test of a sliced Wasserstein flow, given the sliced Wasserstein estimates
+// of its steps: the distance is estimated on the last window of steps and on the
+// previous one, and the flow has converged when it improves by less than tolerance
+// (relative). A single step uses too few directions for a reliable estimate.
+inline bool slicedFlowConverged(const std::vector<double> &distances, size_t window, double tolerance) {
+	const size_t n = distances.size();
+	if ((tolerance <= 0.0) || (n < 2 * window))
+		return false;
+	double previous = 0.0, current = 0.0;
+	for (size_t i = 0; i < window; i++) {
+		previous += distances[n - 2 * window + i] * distances[n - 2 * window + i];
+		current += distances[n - window + i] * distances[n - window + i];
+	}
+	previous = sqrt(previous / window);
+	current = sqrt(current / window);
+	return (previous - current) < tolerance * previous;
+}
 
-template<typename T>
-Point<2, T> BoxMuller() {
-	double r1 = uniform(engine);
-	double r2 = uniform(engine);
 
-	Point<2, T> p;
-	double f = sqrt(-2 * log(std::max(1E-12, std::min(1. - 1E-12, r1))));
-	p[0] = f * cos(2 * M_PI*r2);
-	p[1] = f * sin(2 * M_PI*r2);
-	return p;
-}
+// Time budget of an anytime flow: a step is only started if it is expected to end
+// before the budget (in seconds, 0 = no budget) is spent, the duration of a step being
+// estimated by the mean duration of the previous ones. The budget starts at construction.
+class StepBudget {
+public:
+	explicit StepBudget(double seconds) : budget(seconds), start(std::chrono::steady_clock::now()), stepSeconds(0.0), nbSteps(0) {}
+
+	// records the duration of one more step
+	void addStep(double seconds) { stepSeconds += seconds; nbSteps++; }
+
+	// seconds since the construction
+	double elapsed() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+	// true if the next step would not end within the budget
+	bool exhausted() const {
+		if (budget <= 0.0)
+			return false;
+		const double next = nbSteps ? stepSeconds / nbSteps : 0.0;
+		return elapsed() + next > budget;
+	}
+
+private:
+	double budget;
+	std::chrono::steady_clock::time_point start;
+	double stepSeconds;
+	int nbSteps;
+};
 
 
 template<int DIM, typename T>
@@ -113,10 +144,52 @@ struct Projector {
 class UnbalancedSliced {
 public:
 
-
-	// nearest neighbors in 1d
+	UnbalancedSliced() : useRadixSort(true), useHistogram(false), histogramBins(1 << 17), seed(DirectionSequence::DEFAULT_SEED), directions(DirectionSequence::GAUSSIAN), tolerance(0.0), computeDistances(true), timeBudget(0.0), progressSlices(0) {};
+
+	// sorts the projections with the parallel radix sort (true) or with std::sort (false)
+	bool useRadixSort;
+
+	// approximate slices of correspondencesNd: the projections are ordered by counting
+	// sorts on histogramBins bins over their ranges (see HistogramSorter), and the 1D
+	// partial transport is approximated by approximateTransport1d
+	bool useHistogram;
+	size_t histogramBins;
+
+	// seed and schedule of the slice directions: the k-th slice of a call uses the
+	// k-th direction of DirectionSequence(DIM, seed, directions), whatever the
+	// number of threads
+	uint64_t seed;
+	DirectionSequence::Schedule directions;
+
+	// with tolerance > 0, correspondencesNd stops as soon as the sliced Wasserstein
+	// distance estimated on its last 16 slices improves by less than tolerance
+	// (relative) on the one of the 16 previous slices (see slicedFlowConverged)
+	double tolerance;
+
+	// with computeDistances false, the advected slices of correspondencesNd only compute
+	// the 1D assignments, not their costs (unless tolerance > 0): distances() is then
+	// empty and the returned distance is 0
+	bool computeDistances;
+
+	// with timeBudget > 0 (seconds), correspondencesNd stops before the slice that
+	// would exceed it (see StepBudget); at least one slice is performed
+	double timeBudget;
+
+	// with progressSlices > 0, progress(k) is called every progressSlices slices but
+	// the last one, k being the number of slices performed (cloud1 holds the current
+	// result if advected). The time spent in progress is not counted in the duration
+	// of the slices, but it is in the budget.
+	int progressSlices;
+	std::function<void(int)> progress;
+
+	// sliced Wasserstein estimates of the slices of the last correspondencesNd call
+	// (square root of the mean 1D transport cost of the points of cloud1)
+	const std::vector<double>& distances() const { return sliceDistances; }
+
+	// nearest neighbors in 1d, by a linear scan of hist2 from the previous match
+	// (reference implementation of nearest_neighbor_match)
 	template<typename T>
-	void nearest_neighbor_match(const T *hist1, const T* hist2, const params &p, std::vector<int> &assignment) {
+	void nearest_neighbor_match_scan(const T *hist1, const T* hist2, const params &p, int* assignment) {
 
 		int cursor = p.start1;
 		for (int i = p.start0; i < p.end0; i++) {
@@ -138,21 +211,81 @@ public:
 		}
 	}
 
+	// nearest neighbors in 1d, same result as nearest_neighbor_match_scan.
+	// Before the first point of hist2 not below hist1[i], the costs decrease: the scan
+	// would move its minimum up to the last of these points without stopping, so they
+	// are skipped by a galloping search. Beyond, the costs are non-decreasing: after the
+	// first of these points, they are not below the minimum and the scan stops at the
+	// first cost above the minimum (+epsilon), the match being the last point at the
+	// minimum (runs of ties), which is found by blocks of SIMD compares (SimdKernels.h).
+	template<typename T>
+	void nearest_neighbor_match(const T *hist1, const T* hist2, const params &p, int* assignment) {
+
+		int cursor = p.start1;
+		for (int i = p.start0; i < p.end0; i++) {
+			const T h = hist1[i];
+			T mind = std::numeric_limits<T>::max();
+			int minj = -1;
+			int j = std::max(p.start1, cursor);
+			const int k = gallop(hist2, j, p.end1, h);
+			j = std::max(j, k - 1);
+
+			// the points up to index k + 3 are scanned one by one (most scans are that
+			// short when both sequences have similar densities)
+			bool stopped = false;
+			const int scalarEnd = std::min(p.end1, std::max(j, k) + 4);
+			for (; (j < scalarEnd) && !stopped; j++) {
+				const T d = cost(h, hist2[j]);
+				cursor = j - 1;
+				if (d <= mind) {
+					mind = d;
+					minj = j;
+				} else if (d > mind + std::numeric_limits<T>::epsilon()) {
+					stopped = true;
+				}
+			}
+			if (!stopped && (j < p.end1)) {
+				const int n = p.end1 - j;
+				int lastMin;
+				const int stop = scanNonDecreasing(hist2 + j, n, h, mind, mind + std::numeric_limits<T>::epsilon(), lastMin);
+				if (lastMin >= 0) minj = j + lastMin;
+				cursor = j + std::min(stop, n - 1) - 1;
+			}
+			assignment[i] = minj;
+		}
+	}
+
+	// first index k in [begin, end) such that values[k] >= h (end if none), for values
+	// sorted in increasing order: linear search of the first 8 values (k is usually
+	// close to begin when both sequences have similar densities), then exponential
+	// search and binary search
+	template<typename T>
+	static int gallop(const T* values, int begin, int end, T h) {
+		const int linearEnd = std::min(end, begin + 8);
+		for (; begin < linearEnd; begin++)
+			if (values[begin] >= h) return begin;
+		if (begin >= end) return end;
+		int lo = begin - 1, step = 1; // values[lo] < h
+		while ((lo + step < end) && (values[lo + step] < h)) {
+			lo += step;
+			step *= 2;
+		}
+		return (int)(std::lower_bound(values + lo + 1, values + std::min(end, lo + step), h) - values);
+	}
+
 	// handles the case where the first sequence starts before or ends after the second sequence, or where the NN of the first (resp. last) elements of hist1 are the first (resp. last) elements of hist2
 	// also restricts problem size based on the number of non-injective values, but that won't be super useful
 	// returns 1 if hist1 entirely consumed ; 0 otherwise
 	template<typename T>
-	int reduce_range(const T *hist1, const T* hist2, std::vector<int> &assignment, params &inparam, T& emd, int* assNN, int nbbij) {
+	int reduce_range(const T *hist1, const T* hist2, int* assignment, params &inparam, int* assNN, int nbbij) {
 		params p0 = inparam;
 
 		/// hist1 (partly) at the left of hist2 : can match the outside of hist1 to the begining of hist2
 		int cursor1 = inparam.start1;
 		int min0 = inparam.start0;
-		T localchange = 0;
 		for (int i = inparam.start0; i < inparam.end0; i++) {
 			if (hist1[i] <= hist2[cursor1]) {
 				assignment[i] = cursor1;
-				localchange += cost(hist1[i], hist2[cursor1]);
 				cursor1++;
 				min0 = i + 1;
 			} else break;
@@ -161,8 +294,6 @@ public:
 		inparam.start1 = cursor1;
 
 		if (inparam.end0 == inparam.start0) {
-#pragma omp atomic
-			emd += localchange;
 			return 1;
 		}
 
@@ -172,7 +303,6 @@ public:
 		for (int i = inparam.end0 - 1; i >= inparam.start0; i--) {
 			if (hist1[i] >= hist2[cursor1b]) {
 				assignment[i] = cursor1b;
-				localchange += cost(hist1[i], hist2[cursor1b]);
 				cursor1b--;
 				max0 = i - 1;
 			} else break;
@@ -182,8 +312,6 @@ public:
 		inparam.end1 = cursor1b + 1;
 
 		if (inparam.end0 == inparam.start0) {
-#pragma omp atomic
-			emd += localchange;
 			return 1;
 		}
 
@@ -203,7 +331,6 @@ public:
 		for (i = inparam.start0; i < inparam.end0; i++) {
 			if (assNN[i] == cursor && (i == inparam.end0 - 1 || assNN[i + 1] != assNN[i])) {
 				assignment[i] = cursor;
-				localchange += cost(hist1[i], hist2[assignment[i]]);
 				cursor++;
 			} else break;
 		}
@@ -211,8 +338,6 @@ public:
 		inparam.start1 = cursor;
 
 		if (inparam.start0 == inparam.end0) {
-#pragma omp atomic
-			emd += localchange;
 			return 1;
 		}
 
@@ -223,7 +348,6 @@ public:
 		for (i = inparam.end0 - 1; i >= inparam.start0; i--) {
 			if (assNN[i] == cursor && (i == inparam.start0 || assNN[i - 1] != assNN[i])) {
 				assignment[i] = cursor;
-				localchange += cost(hist1[i], hist2[assignment[i]]);
 				cursor--;
 			} else break;
 		}
@@ -231,14 +355,10 @@ public:
 		inparam.end1 = cursor + 1;
 
 		if (inparam.start0 == inparam.end0) {
-#pragma omp atomic
-			emd += localchange;
 			return 1;
 		}
 
 
-#pragma omp atomic
-		emd += localchange;
 		return 0;
 	}
 
@@ -249,7 +369,7 @@ public:
 	// return 0 = problem not solved
 
 	template<typename T>
-	int handle_simple_cases(const params &p, const T* hist1, const T* hist2, int* assignment, int* assNN, T &value) {
+	int handle_simple_cases(const params &p, const T* hist1, const T* hist2, int* assignment, int* assNN) {
 		int start0 = p.start0;
 		int start1 = p.start1;
 		int end0 = p.end0;
@@ -258,13 +378,9 @@ public:
 		int N = end1 - start1;
 		if (M == 0) return 1;
 		if (M == N) {
-			T d = 0;
 			for (int i = 0; i < M; i++) {
 				assignment[start0 + i] = i + start1;
-				d += cost(hist1[start0 + i], hist2[start1 + i]);
 			}
-#pragma omp atomic
-			value += d;
 			return 1;
 		}
 		if (M == N - 1) {
@@ -293,23 +409,16 @@ public:
 					assignment[start0 + i] = i + 1 + start1;
 				}
 			}
-#pragma omp atomic
-			value += best_s;
 			return 1;
 		}
 		if (M == 1) {
 			assignment[start0] = assNN[start0];
-			T c = cost(hist1[start0], hist2[assNN[start0]]);
-
-#pragma omp atomic
-			value += c;
 			return 1;
 		}
 
 // checks if NN is injective
 		{
 			int curId = 0;
-			T sumMin = 0;
 			bool valid = true;
 			for (int i = 0; i < M; i++) {
 				int ass;
@@ -335,12 +444,9 @@ public:
 					valid = false;
 					break;
 				}
-				sumMin += mini;
 				assignment[start0 + i] = ass;
 			}
 			if (valid) {
-#pragma omp atomic
-				value += sumMin;
 				return 1;
 			}
 		}
@@ -453,7 +559,7 @@ public:
 
 
 	template<typename T>
-	void simple_solve(const params &p, const T* hist1, const T* hist2, int* assignment, int* assNN, T &value) {
+	void simple_solve(const params &p, const T* hist1, const T* hist2, int* assignment, int* assNN) {
 
 		int N = p.end1 - p.start1;
 		std::vector<int> taken(N, -1);
@@ -568,7 +674,6 @@ public:
 					curp.end1 = curp.start1 + 1;
 					for (int j = 0; j < curp.end0 - curp.start0; j++) {
 						assignment[curp.start0 + j] = curp.start1 + j;
-						value += cost(hist1[curp.start0 + j], hist2[curp.start1 + j]);
 					}
 				}
 				else {
@@ -586,7 +691,6 @@ public:
 					curp.end1 = p.start1 + right + 1;
 					for (int j = 0; j < curp.end0 - curp.start0; j++) {
 						assignment[curp.start0 + j] = curp.start1 + j;
-						value += cost(hist1[curp.start0 + j], hist2[curp.start1 + j]);
 					}
 					i = p.start1 + right;
 				}
@@ -596,16 +700,90 @@ public:
 	}
 
 
+	// Approximate alternative to transport1d in O(M0 + N0), for hist1 and hist2 sorted
+	// (up to the width of a histogram bin): each point of hist1 is matched to its nearest
+	// neighbor in hist2, and the collisions are resolved by pushing the colliding
+	// matches to the right (forward sweep) and to the left (backward sweep), the
+	// assignment being the midpoint of the two injective and increasing solutions.
+	// Returns the cost of the assignment (0 if computeCost is false).
 	template<typename T>
-	T transport1d(const T *hist1, const T* hist2, int M0, int N0, std::vector<int> &assignment, double* timingSplits = NULL) {
+	T approximateTransport1d(const T *hist1, const T* hist2, int M0, int N0, std::vector<int> &assignment, bool computeCost = true) {
+
+		assignment.resize(M0);
+		std::vector<int> &forward = assignment;
+		std::vector<int> backward(M0);
+
+		// nearest neighbors (both sequences are increasing)
+		int j = 0;
+		for (int i = 0; i < M0; i++) {
+			while ((j + 1 < N0) && (std::abs(hist2[j + 1] - hist1[i]) <= std::abs(hist2[j] - hist1[i]))) j++;
+			forward[i] = j;
+			backward[i] = j;
+		}
+
+		// forward: collisions pushed to the right, then bounded so that the remaining
+		// points fit on the right
+		for (int i = 1; i < M0; i++)
+			forward[i] = std::max(forward[i], forward[i - 1] + 1);
+		for (int i = M0 - 1; i >= 0; i--)
+			forward[i] = std::min(forward[i], (i == M0 - 1) ? N0 - 1 : forward[i + 1] - 1);
+
+		// backward: collisions pushed to the left, then bounded on the left
+		for (int i = M0 - 2; i >= 0; i--)
+			backward[i] = std::min(backward[i], backward[i + 1] - 1);
+		for (int i = 0; i < M0; i++)
+			backward[i] = std::max(backward[i], (i == 0) ? 0 : backward[i - 1] + 1);
+
+		for (int i = 0; i < M0; i++)
+			assignment[i] = (forward[i] + backward[i]) / 2;
+		return computeCost ? assignmentCost(hist1, hist2, &assignment[0], M0) : 0;
+	}
+
+
+	// cost of the assignment of hist1[0..M-1] into hist2, summed in double precision
+	// by blocks of fixed size: the blocks are summed in parallel (when not already
+	// running on the thread pool) and then in order, so that the result does not
+	// depend on the number of threads
+	template<typename T>
+	T assignmentCost(const T *hist1, const T* hist2, const int* assignment, int M) {
+		const int BLOCK = 1 << 14;
+		const int nbBlocks = (M + BLOCK - 1) / BLOCK;
+		std::vector<double> sums(nbBlocks);
+#pragma omp parallel for if(nbBlocks > 1 && !ThreadPool::nested())
+		for (int b = 0; b < nbBlocks; b++) {
+			double sum = 0;
+			const int end = std::min(M, (b + 1) * BLOCK);
+			for (int i = b * BLOCK; i < end; i++)
+				sum += cost(hist1[i], hist2[assignment[i]]);
+			sums[b] = sum;
+		}
+		double value = 0;
+		for (int b = 0; b < nbBlocks; b++)
+			value += sums[b];
+		return (T)value;
+	}
+
+
+	// Partial 1D transport of the sorted hist1[0..M0-1] into the sorted hist2[0..N0-1]
+	// (M0 <= N0). The subproblems only write their part of the assignment; its cost
+	// is evaluated once all of them are solved (see assignmentCost), unless the
+	// caller only needs the assignment (computeCost = false, 0 is returned).
+	// The subproblems are OpenMP tasks created largest first, those that still decompose
+	// once reduced being split recursively (see solve_split). If timingSplits is not
+	// NULL, it receives the time (in seconds) spent on each subproblem, its subproblems
+	// excluded, in increasing order of their first point of hist1.
+	template<typename T>
+	T transport1d(const T *hist1, const T* hist2, int M0, int N0, std::vector<int> &assignment, std::vector<double>* timingSplits = NULL, bool computeCost = true) {
 
 		assignment.resize(M0);
 		params initp(0, M0, 0, N0, 0);
-		T value = 0;
+		std::vector<SplitTiming> timings;
+		std::vector<SplitTiming>* splitTimings = timingSplits ? &timings : NULL;
+		if (timingSplits) timingSplits->clear();
 
 		// starts computing nearest neighbor match
 		std::vector<int> assNN(M0);
-		nearest_neighbor_match(hist1, hist2, initp, assNN);
+		nearest_neighbor_match(hist1, hist2, initp, &assNN[0]);
 
 		// computes the number of non-injective matches in an interval
 		int nbbij = 0;
@@ -613,10 +791,10 @@ public:
 			if (assNN[i] == assNN[i - 1]) nbbij++;
 		}
 
-		int ret1 = reduce_range(hist1, hist2, assignment, initp, value, &assNN[0], nbbij);
-		if (ret1 == 1) return value;
+		int ret1 = reduce_range(hist1, hist2, &assignment[0], initp, &assNN[0], nbbij);
+		if (ret1 == 1) return computeCost ? assignmentCost(hist1, hist2, &assignment[0], M0) : 0;
 
-		nearest_neighbor_match(hist1, hist2, initp, assNN); // since the bounds of the problem have changed, the NN maps has changed as well
+		nearest_neighbor_match(hist1, hist2, initp, &assNN[0]); // since the bounds of the problem have changed, the NN maps has changed as well
 		std::vector<params> splits;
 
 		bool res = linear_time_decomposition(initp, hist1, hist2, &assNN[0], splits);
@@ -627,7 +805,6 @@ public:
 			for (int i = 0; i < splits.size(); i++) {
 				if (splits[i].end0 == splits[i].start0 + 1) { // we directly handle problems of size 1 here
 					assignment[splits[i].start0] = assNN[splits[i].start0];
-					value += cost(hist1[splits[i].start0], hist2[assNN[splits[i].start0]]);
 				}
 				else
 					todo.push_back(splits[i]);
@@ -637,33 +814,93 @@ public:
 			todo.push_back(initp);
 		}
 
-#pragma omp parallel for schedule(dynamic)
-		for (int i = 0; i < todo.size(); i++) {
+		// largest subproblems first (LPT), so that a large one does not end up as the
+		// tail of the loop ; the order does not change the result, the subproblems
+		// being independent
+		std::sort(todo.begin(), todo.end(), [](const params &a, const params &b) {
+			return (a.end0 - a.start0 > b.end0 - b.start0) || ((a.end0 - a.start0 == b.end0 - b.start0) && (a.start0 < b.start0));
+		});
+		int* ass = &assignment[0];
+		int* nn = &assNN[0];
+
+		// serial when already running on the thread pool (e.g. one slice per worker)
+#pragma omp parallel if(todo.size() > 1 && !ThreadPool::nested())
+#pragma omp single
+		{
+			for (int i = 0; i < todo.size(); i++) {
+				const params p = todo[i];
+#pragma omp task firstprivate(p) if(p.end0 - p.start0 >= SPLIT_TASK_SIZE)
+				solve_split(p, hist1, hist2, ass, nn, splitTimings);
+			}
+		}
+
+		if (timingSplits) {
+			std::sort(timings.begin(), timings.end());
+			for (int i = 0; i < timings.size(); i++)
+				timingSplits->push_back(timings[i].seconds);
+		}
 
-			params p = todo[i];
+		return computeCost ? assignmentCost(hist1, hist2, &assignment[0], M0) : 0;
+	}
 
-			nearest_neighbor_match(hist1, hist2, p, assNN); // since the bounds of the problem have changed, the NN maps has changed as well
-			int ret = handle_simple_cases(p, hist1, hist2, &assignment[0], &assNN[0], value);
-			if (ret == 1) continue;
+
+	// subproblems of transport1d smaller than this are solved by the task creating them
+	static const int SPLIT_TASK_SIZE = 1024;
+
+	// time spent on a subproblem of transport1d, ordered by position (then largest first)
+	struct SplitTiming {
+		int start0, end0;
+		double seconds;
+		bool operator<(const SplitTiming &o) const {
+			return (start0 < o.start0) || ((start0 == o.start0) && (end0 > o.end0));
+		}
+	};
+
+	// solves a subproblem of transport1d: simple cases, range reduction, then either
+	// simple_solve or, when the reduced problem decomposes again, its own subproblems,
+	// recursively (those larger than SPLIT_TASK_SIZE as OpenMP tasks)
+	template<typename T>
+	void solve_split(params p, const T* hist1, const T* hist2, int* assignment, int* assNN, std::vector<SplitTiming>* timings) {
+
+		const std::chrono::steady_clock::time_point start = timings ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+		const params p0 = p;
+		std::vector<params> splits;
+
+		nearest_neighbor_match(hist1, hist2, p, assNN); // since the bounds of the problem have changed, the NN maps has changed as well
+		if (!handle_simple_cases(p, hist1, hist2, assignment, assNN)) {
 
 			int nbbij = 0;
 			for (int i = p.start0 + 1; i < p.end0; i++) {
 				if (assNN[i] == assNN[i - 1]) nbbij++;
 			}
 
-			ret = reduce_range(hist1, hist2, assignment, p, value, &assNN[0], nbbij);
-			if (ret == 1) continue;
-
-
-			ret = handle_simple_cases(p, hist1, hist2, &assignment[0], &assNN[0], value);
-			if (ret == 1) continue;
-
-			nearest_neighbor_match(hist1, hist2, p, assNN); // since the bounds of the problem have changed, the NN maps has changed as well
-			simple_solve(p, hist1, hist2, &assignment[0], &assNN[0], value);
+			if (!reduce_range(hist1, hist2, assignment, p, assNN, nbbij) && !handle_simple_cases(p, hist1, hist2, assignment, assNN)) {
+				nearest_neighbor_match(hist1, hist2, p, assNN); // since the bounds of the problem have changed, the NN maps has changed as well
+				if (!linear_time_decomposition(p, hist1, hist2, assNN, splits) || (splits.size() < 2)) {
+					splits.clear();
+					simple_solve(p, hist1, hist2, assignment, assNN);
+				}
+			}
 		}
 
+		if (timings) {
+			SplitTiming t;
+			t.start0 = p0.start0;
+			t.end0 = p0.end0;
+			t.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#pragma omp critical(transport1d_timings)
+			timings->push_back(t);
+		}
 
-		return value;
+		for (int i = 0; i < splits.size(); i++) {
+			const params s = splits[i];
+			if (s.end0 == s.start0 + 1) {
+				assignment[s.start0] = assNN[s.start0];
+				continue;
+			}
+#pragma omp task firstprivate(s) if(s.end0 - s.start0 >= SPLIT_TASK_SIZE)
+			solve_split(s, hist1, hist2, assignment, assNN, timings);
+		}
 	}
 
 
@@ -675,82 +912,148 @@ public:
 	double correspondencesNd(std::vector<Point<DIM, T> > &cloud1, const std::vector<Point<DIM, T> > &cloud2, int niter, bool advect = false) {
 
 
-		// we won't use the indices here for the moment nor the assignment, so if memory is an issue, we can remove the variables below
-		std::vector<std::pair<T, int > > cloud1Idx(cloud1.size());
-		std::vector<std::pair<T, int > > cloud2Idx(cloud2.size());
+		// working buffers are kept in the object between calls
+		NdWorkspace<T> &ws = workspace(T());
+		std::vector<std::pair<T, int > > &cloud1Idx = ws.cloud1Idx;
+		std::vector<std::pair<T, int > > &cloud2Idx = ws.cloud2Idx;
+		std::vector<T> &cloud1Proj = ws.cloud1Proj, &cloud2Proj = ws.cloud2Proj;
+		RadixSorter<T> &sorter = ws.sorter;
+		if (useRadixSort || useHistogram) {
+			cloud1Proj.resize(cloud1.size());
+			cloud2Proj.resize(cloud2.size());
+		} else {
+			cloud1Idx.resize(cloud1.size());
+			cloud2Idx.resize(cloud2.size());
+		}
+		std::vector<unsigned int> &perm1 = ws.perm1, &perm2 = ws.perm2;
+		perm1.resize(cloud1.size());
+		perm2.resize(cloud2.size());
+		ThreadPool &pool = ThreadPool::instance();
 
 
 		Point<DIM, T> dir;
-		std::vector<Point<DIM, T> > deltas(cloud1.size(), Point<DIM, T>());
 
-		T* projHist1 = (T*)malloc_simd(cloud1.size() * sizeof(T), 32);
-		T* projHist2 = (T*)malloc_simd(cloud2.size() * sizeof(T), 32);
+		ws.hist1.resize(cloud1.size());
+		ws.hist2.resize(cloud2.size());
+		T* projHist1 = ws.hist1.data();
+		T* projHist2 = ws.hist2.data();
 
-		engine.seed(10);
-
-		std::vector<int> corr1d;
+		const DirectionSequence sequence(DIM, seed, directions);
+		std::vector<int> &corr1d = ws.corr1d;
 		double d = 0;
+		sliceDistances.clear();
+		const bool computeCost = !advect || computeDistances || (tolerance > 0);
+		StepBudget budget(timeBudget);
 		for (int iter = 0; iter < niter; iter++) { // number of random slices
+			auto sliceStart = std::chrono::steady_clock::now();
+
+			// slice direction
+			sequence.direction(iter, dir.coords);
 
-			// random directions
-			double n = 0;
-			for (int i = 0; i < DIM; i+=2) {
-				Point<2, double> randGauss = BoxMuller<double>();
-				dir[i] = randGauss[0];
-				n += dir[i] * dir[i];
-				if (i < DIM-1) {
-					dir[i+1] = randGauss[1];
-					n += dir[i+1] * dir[i+1];
-				}
-			}
-			n = std::sqrt(n);
-			for (int i = 0; i < DIM; i++) {
-				dir[i] /= n;
-			}
 
+			Profiler::Scope sliceScope("slice", true);
 
 			// sort according to projection on direction
 			Projector<DIM, T> proj(dir);
 
-			for (int i = 0; i < cloud1.size(); i++) {
-				cloud1Idx[i] = std::make_pair(proj.proj(cloud1[i]), i);
-			}
+			if (useRadixSort || useHistogram) {
+				{
+					Profiler::Scope scope("projection");
+					pool.parallelFor(cloud1.size(), [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; i++) {
+							cloud1Proj[i] = proj.proj(cloud1[i]);
+						}
+					});
+					pool.parallelFor(cloud2.size(), [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; i++) {
+							cloud2Proj[i] = proj.proj(cloud2[i]);
+						}
+					});
+				}
 
-			for (int i = 0; i < cloud2.size(); i++) {
-				cloud2Idx[i] = std::make_pair(proj.proj(cloud2[i]), i);
-			}
+				// the sorted projections are directly written to the histograms
+				Profiler::Scope scope("sort");
+				if (useHistogram) {
+					ws.histogram.argsort(&cloud1Proj[0], cloud1.size(), histogramBins, &perm1[0], projHist1);
+					ws.histogram.argsort(&cloud2Proj[0], cloud2.size(), histogramBins, &perm2[0], projHist2);
+				} else {
+					sorter.argsort(&cloud1Proj[0], &perm1[0], cloud1.size(), projHist1);
+					sorter.argsort(&cloud2Proj[0], &perm2[0], cloud2.size(), projHist2);
+				}
+			} else {
+				{
+					Profiler::Scope scope("projection");
+					pool.parallelFor(cloud1.size(), [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; i++) {
+							cloud1Idx[i] = std::make_pair(proj.proj(cloud1[i]), (int)i);
+						}
+					});
+					pool.parallelFor(cloud2.size(), [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; i++) {
+							cloud2Idx[i] = std::make_pair(proj.proj(cloud2[i]), (int)i);
+						}
+					});
+				}
 
+				{
+					Profiler::Scope scope("sort");
+					pool.parallelSort(cloud1Idx.begin(), cloud1Idx.end());
+					pool.parallelSort(cloud2Idx.begin(), cloud2Idx.end());
+				}
 
-			std::thread mythread( [&]{std::sort(cloud1Idx.begin(), cloud1Idx.end()); } );
-			std::sort(cloud2Idx.begin(), cloud2Idx.end());
-                        mythread.join();
-                        
-			for (int i = 0; i < cloud1.size(); i++) {
-				projHist1[i] = cloud1Idx[i].first;
-			}
-			for (int i = 0; i < cloud2.size(); i++) {
-				projHist2[i] = cloud2Idx[i].first;
+				Profiler::Scope scope("copy");
+				pool.parallelFor(cloud1.size(), [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						projHist1[i] = cloud1Idx[i].first;
+						perm1[i] = cloud1Idx[i].second;
+					}
+				});
+				pool.parallelFor(cloud2.size(), [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						projHist2[i] = cloud2Idx[i].first;
+						perm2[i] = cloud2Idx[i].second;
+					}
+				});
 			}
 
 
-			T emd = transport1d(projHist1, projHist2, cloud1.size(), cloud2.size(), corr1d);
+			T emd;
+			{
+				Profiler::Scope scope("transport1d");
+				if (useHistogram)
+					emd = approximateTransport1d(projHist1, projHist2, cloud1.size(), cloud2.size(), corr1d, computeCost);
+				else
+					emd = transport1d(projHist1, projHist2, cloud1.size(), cloud2.size(), corr1d, NULL, computeCost);
+			}
 
 			d += emd;
+			if (computeCost)
+				sliceDistances.push_back(sqrt(emd / cloud1.size()));
 
 
+			// perm1 is a permutation: each point of cloud1 is moved by a single rank
 			if (advect) {
-				for (int i = 0; i < cloud1Idx.size(); i++) {
-					for (int j = 0; j < DIM; j++) {
-						cloud1[cloud1Idx[i].second][j] += (projHist2[corr1d[i]] - projHist1[i])*dir[j];
+				Profiler::Scope scope("advection");
+				pool.parallelFor(cloud1.size(), [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						for (int j = 0; j < DIM; j++) {
+							cloud1[perm1[i]][j] += (projHist2[corr1d[i]] - projHist1[i])*dir[j];
+						}
 					}
-				}
+				});
 			}
-		}
 
-		free_simd(projHist1);
-		free_simd(projHist2);
+			budget.addStep(std::chrono::duration<double>(std::chrono::steady_clock::now() - sliceStart).count());
+			if (slicedFlowConverged(sliceDistances, 16, tolerance) || budget.exhausted())
+				break;
+			if (progress && (progressSlices > 0) && ((iter + 1) % progressSlices == 0) && (iter + 1 < niter)) {
+				progress(iter + 1);
+				if (budget.exhausted())
+					break;
+			}
+		}
 
-		return d*2.0/niter;
+		return sliceDistances.empty() ? 0.0 : d*2.0/sliceDistances.size();
 	}
 
 
@@ -769,9 +1072,8 @@ public:
 		}
 
 		// a fixed set of slice directions across iterations (might be rotated)
-		// random direction for DIM>2, else equispaced
-		srand(10);
-		engine.seed(10);
+		// directions of the sequence for DIM>2, else equispaced
+		const DirectionSequence sequence(DIM, seed, directions);
 		std::vector<Point<DIM, T> > dirs(nslices);
 		for (int slice = 0; slice < nslices; slice++) {
 			if (DIM == 2) {
@@ -779,29 +1081,17 @@ public:
 				dirs[slice][0] = cos(theta);
 				dirs[slice][1] = sin(theta);
 			} else {
-				double n = 0;
-				for (int i = 0; i < DIM; i+=2) {
-					Point<2, double> randGauss = BoxMuller<double>();
-					dirs[slice][i] = randGauss[0];
-					n += dirs[slice][i] * dirs[slice][i];
-					if (i < DIM - 1) {
-						dirs[slice][i + 1] = randGauss[1];
-						n += dirs[slice][i + 1] * dirs[slice][i + 1];
-					}
-				}
-				n = std::sqrt(n);
-				for (int i = 0; i < DIM; i++) {
-					dirs[slice][i] /= n;
-				}
+				sequence.direction(slice, dirs[slice].coords);
 			}
 		}
 
-		std::vector<T*> projHist1(omp_get_max_threads());
-		for (int i=0; i< omp_get_max_threads() ; i++)
-			projHist1[i] = (T*)malloc_simd(barycenter.size() * sizeof(T), 32);
-
-		std::vector<std::vector<std::pair<T, int > > > cloud1Idx(omp_get_max_threads(), std::vector<std::pair<T, int > >(Mbary));
-		std::vector<std::vector<std::pair<T, int > > > cloud2Idx(omp_get_max_threads());
+		// slices are split in contiguous chunks processed on the thread pool, each chunk owning its buffers.
+		// Each slice stores its 1D displacements (and cost), which are then added in the slice
+		// order, so that the result does not depend on the number of threads
+		ThreadPool &pool = ThreadPool::instance();
+		const int nbChunks = std::max(1, std::min(nslices, (int)pool.size()));
+		std::vector<std::vector<T> > sliceDisplacements(nslices, std::vector<T>(Mbary));
+		std::vector<double> sliceCosts(nslices);
 
 		for (int iter = 0; iter < niters; iter++) {
 
@@ -811,72 +1101,69 @@ public:
 			std::vector<Point<DIM, T> > newbary = barycenter;
 			for (int cloud = 0; cloud < points.size(); cloud++) {
 
-#pragma omp parallel
-				{
-					int thread_num = omp_get_thread_num();
-					cloud2Idx[thread_num].resize(points[cloud].size());
+				pool.parallelChunks(nbChunks, [&](size_t chunk) {
+					T* projHist1 = (T*)malloc_simd(barycenter.size() * sizeof(T), 32);
 					T* projHist2 = (T*)malloc_simd(points[cloud].size() * sizeof(T), 32);
+					std::vector<std::pair<T, int > > cloud1Idx(Mbary);
+					std::vector<std::pair<T, int > > cloud2Idx(points[cloud].size());
 					std::vector<int> corr1d;
-					double local_d = 0;
 
-#pragma omp for schedule(dynamic)
-					for (int slice = 0; slice < nslices; slice++) { // number of random slices
+					for (int slice = chunk*nslices / nbChunks; slice < (chunk + 1)*nslices / nbChunks; slice++) { // number of random slices
 
 						Point<DIM, T> dir = dirs[slice];
 
 						// sort according to projection on direction
 						Projector<DIM, T> proj(dir);
 						for (int i = 0; i < Mbary; i++) {
-							cloud1Idx[thread_num][i] = std::make_pair(proj.proj(barycenter[i]), i);
+							cloud1Idx[i] = std::make_pair(proj.proj(barycenter[i]), i);
 						}
 						for (int i = 0; i < points[cloud].size(); i++) {
-							cloud2Idx[thread_num][i] = std::make_pair(proj.proj(points[cloud][i]), i);
+							cloud2Idx[i] = std::make_pair(proj.proj(points[cloud][i]), i);
+						}
+						std::sort(cloud1Idx.begin(), cloud1Idx.end());
+						for (int i = 0; i < Mbary; i++) {
+							projHist1[i] = cloud1Idx[i].first;
 						}
-                                                std::thread mythread( [&]{
-                                                                        std::sort(cloud1Idx[thread_num].begin(), cloud1Idx[thread_num].end());
-
-                                                                        for (int i = 0; i < Mbary; i++) {
-                                                                          projHist1[thread_num][i] = cloud1Idx[thread_num][i].first;
-                                                                        }
-                                                                      });
-
-						std::sort(cloud2Idx[thread_num].begin(), cloud2Idx[thread_num].end());
 
+						std::sort(cloud2Idx.begin(), cloud2Idx.end());
 						for (int i = 0; i < points[cloud].size(); i++) {
-							projHist2[i] = cloud2Idx[thread_num][i].first;
+							projHist2[i] = cloud2Idx[i].first;
 						}
 
-                                                mythread.join();
-						transport1d(projHist1[thread_num], projHist2, Mbary, points[cloud].size(), corr1d);
+						transport1d(projHist1, projHist2, Mbary, points[cloud].size(), corr1d, NULL, false);
 
 
+						double local_d = 0;
 						for (int i = 0; i < corr1d.size(); i++) {
-							local_d += weights[cloud] * cost(projHist1[thread_num][i], projHist2[corr1d[i]]);
+							local_d += weights[cloud] * cost(projHist1[i], projHist2[corr1d[i]]);
 						}
-#pragma omp critical
-						{
-							for (int i = 0; i < cloud1Idx[thread_num].size(); i++) {
-								int perm = cloud1Idx[thread_num][i].second;
-								for (int j = 0; j < DIM; j++) {
-									newbary[perm][j] += DIM * (weights[cloud] * (projHist2[corr1d[i]] - projHist1[thread_num][i])*dir[j]) / nslices;
-								}
-							}
+						sliceCosts[slice] = local_d;
+						for (int i = 0; i < cloud1Idx.size(); i++) {
+							sliceDisplacements[slice][cloud1Idx[i].second] = projHist2[corr1d[i]] - projHist1[i];
 						}
 					}
+					free_simd(projHist1);
 					free_simd(projHist2);
-#pragma omp atomic
-					d += local_d;
-				}
+				});
+
+				pool.parallelFor(Mbary, [&](size_t begin, size_t end) {
+					for (int slice = 0; slice < nslices; slice++) {
+						const std::vector<T> &disp = sliceDisplacements[slice];
+						for (size_t i = begin; i < end; i++) {
+							for (int j = 0; j < DIM; j++) {
+								newbary[i][j] += DIM * (weights[cloud] * disp[i] * dirs[slice][j]) / nslices;
+							}
+						}
+					}
+				});
+				for (int slice = 0; slice < nslices; slice++)
+					d += sliceCosts[slice];
 
 			}
 			barycenter = newbary;
 		}
 
 
-		for (int i=0; i<omp_get_max_threads(); i++)
-			free_simd(projHist1[i]);
-
-
 	}
 
 
@@ -958,5 +1245,24 @@ public:
 	}
 
 
+private:
+
+	// working buffers of correspondencesNd
+	template<typename T>
+	struct NdWorkspace {
+		std::vector<std::pair<T, int > > cloud1Idx, cloud2Idx;
+		std::vector<T> cloud1Proj, cloud2Proj;
+		std::vector<unsigned int> perm1, perm2;
+		AlignedBuffer<T> hist1, hist2; // sorted projections
+		std::vector<int> corr1d;
+		RadixSorter<T> sorter;
+		HistogramSorter<T> histogram;
+	};
+	NdWorkspace<float> workspaceFloat;
+	NdWorkspace<double> workspaceDouble;
+	NdWorkspace<float>& workspace(float) { return workspaceFloat; }
+	NdWorkspace<double>& workspace(double) { return workspaceDouble; }
+
+	std::vector<double> sliceDistances;
 
 }; // end class
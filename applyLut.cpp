@@ -0,0 +1,114 @@
+/*
+ Copyright (c) 2019 CNRS
+ David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+ 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+//Command-line parsing
+#include "CLI11.hpp"
+
+//Image I/O
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "UnbalancedSliced/ThreadPool.h"
+#include "UnbalancedSliced/CubeLut.h"
+
+//Applies a 3D LUT (.cube file, e.g. exported by colorTransfer --lut) to a
+//list of images. Frames are processed one after the other, the pixels of a
+//frame being split over all the cores.
+int main(int argc, char **argv)
+{
+  CLI::App app{"applyLut"};
+  std::string lutFile;
+  app.add_option("-l,--lut", lutFile, "3D LUT (.cube)")->required()->check(CLI::ExistingFile);
+  std::vector<std::string> inputImages;
+  app.add_option("-i,--input", inputImages, "Input images")->required()->check(CLI::ExistingFile);
+  std::string output = "output.png";
+  app.add_option("-o,--output", output, "Output image (one input) or output directory (several inputs)");
+  std::string interpolation = "tetrahedral";
+  app.add_option("--interpolation", interpolation, "Interpolation of the LUT: trilinear or tetrahedral (tetrahedral)")->check(CLI::IsMember({"trilinear", "tetrahedral"}));
+  unsigned int nbThreads = 0;
+  app.add_option("--threads", nbThreads, "Number of threads of the worker pool (0 = all cores)");
+  bool silent = false;
+  app.add_flag("--silent", silent, "No verbose messages");
+  CLI11_PARSE(app, argc, argv);
+  
+  ThreadPool::instance().resize(nbThreads);
+  
+  CubeLut lut;
+  if (!lut.load(lutFile))
+  {
+    std::cout<<"Error while loading the LUT (3D .cube files in the [0,1] domain are supported)."<<std::endl;
+    exit(1);
+  }
+  if (!silent) std::cout<<"LUT: "<<lut.size<<"^3"<<std::endl;
+  const CubeLut::Interpolation mode = (interpolation == "trilinear") ? CubeLut::TRILINEAR : CubeLut::TETRAHEDRAL;
+  
+  std::chrono::duration<double> computeSeconds(0.0);
+  size_t nbPixels = 0;
+  auto start = std::chrono::system_clock::now();
+  for(auto f = 0; f < inputImages.size(); ++f)
+  {
+    int width,height, nbChannels;
+    unsigned char *image = stbi_load(inputImages[f].c_str(), &width, &height, &nbChannels, 0);
+    if ((image == NULL) || (nbChannels < 3))
+    {
+      std::cout<< "Input images must be color images."<<std::endl;
+      exit(1);
+    }
+    
+    auto startFrame = std::chrono::system_clock::now();
+    lut.apply(image, image, width*height, nbChannels, mode);
+    computeSeconds += std::chrono::system_clock::now() - startFrame;
+    nbPixels += width*height;
+    
+    //Output file name
+    std::string outputImage = output;
+    if (inputImages.size() > 1)
+    {
+      std::string name = inputImages[f].substr(inputImages[f].find_last_of("/\\") + 1);
+      outputImage = output + "/" + name.substr(0, name.find_last_of('.')) + ".png";
+    }
+    if (!silent) std::cout<<inputImages[f]<<" -> "<<outputImage<<std::endl;
+    int errcode = stbi_write_png(outputImage.c_str(), width, height, nbChannels, image, nbChannels*width);
+    if (!errcode)
+    {
+      std::cout<<"Error while exporting the resulting image."<<std::endl;
+      exit(1);
+    }
+    stbi_image_free(image);
+  }
+  std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start;
+  
+  std::cout << "elapsed time: " << elapsed_seconds.count() << "s ("<<inputImages.size()/elapsed_seconds.count()<<" frames/s)\n"
+  << "LUT time: " << computeSeconds.count() << "s (" << nbPixels/computeSeconds.count()*1e-6 << " Mpixels/s)\n";
+  exit(0);
+}
@@ -0,0 +1,850 @@
+/*
+ Copyright (c) 2019 CNRS
+ David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+ 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+//Command-line parsing
+#include "CLI11.hpp"
+
+//Baseline bilateral filter
+#define cimg_display 0
+#include "CImg.h"
+
+#include "UnbalancedSliced/TransferContext.h"
+#include "UnbalancedSliced/BilateralGrid.h"
+#include "UnbalancedSliced/SimdKernels.h"
+#include "UnbalancedSliced/Profiler.h"
+
+//Offline benchmarks of the transfer engine on synthetic inputs.
+//Each case is run for every requested thread count; the reported time is
+//the fastest of the repetitions. The checksums only depend on the inputs
+//and the parameters, so that two runs (or two thread counts) can be
+//compared. The quality benchmarks also report the error of the result.
+
+//Deterministic inputs: only the raw output of std::mt19937 (whose sequence
+//is fixed by the standard) is used, so that the inputs are the same on
+//every platform.
+struct Generator
+{
+  Generator(unsigned int seed) : engine(seed) {}
+  //Uniform in [0,1)
+  double uniform() { return (engine() >> 8) * (1.0/16777216.0); }
+  //Standard normal (Box-Muller)
+  double normal()
+  {
+    const double r1 = std::max(1e-12, uniform());
+    const double r2 = uniform();
+    return std::sqrt(-2.0*std::log(r1)) * std::cos(2.0*M_PI*r2);
+  }
+  std::mt19937 engine;
+};
+
+//One measurement
+struct Result
+{
+  std::string suite;
+  std::string name;
+  std::string size;
+  unsigned int threads;
+  double seconds;
+  //Points (pixels) processed per second, and 1D problems solved per second
+  double pointsPerSecond;
+  double slicesPerSecond;
+  double speedup;
+  double checksum;
+  //Error of the result (negative if not measured)
+  double error;
+};
+
+std::vector<Result> results;
+
+void report(const std::string &suite, const std::string &name, const std::string &size,
+            const double seconds, const double points, const double slices,
+            const double baseline, const double checksum, const double error = -1.0)
+{
+  Result r;
+  r.suite = suite;
+  r.name = name;
+  r.size = size;
+  r.threads = ThreadPool::instance().size();
+  r.seconds = seconds;
+  r.pointsPerSecond = points / seconds;
+  r.slicesPerSecond = slices / seconds;
+  r.speedup = baseline / seconds;
+  r.checksum = checksum;
+  r.error = error;
+  results.push_back(r);
+  
+  std::cout<<std::left<<std::setw(12)<<suite<<std::setw(22)<<name<<std::setw(16)<<size
+           <<std::right<<std::setw(4)<<r.threads
+           <<std::fixed<<std::setprecision(2)<<std::setw(12)<<1000.0*seconds
+           <<std::setw(12)<<r.pointsPerSecond/1e6;
+  if (slices > 0)
+    std::cout<<std::setw(12)<<r.slicesPerSecond;
+  else
+    std::cout<<std::setw(12)<<"-";
+  std::cout<<std::setw(9)<<r.speedup
+           <<std::scientific<<std::setprecision(9)<<std::setw(20)<<checksum;
+  if (error >= 0.0)
+    std::cout<<std::setprecision(4)<<std::setw(14)<<error;
+  else
+    std::cout<<std::setw(14)<<"-";
+  std::cout<<std::defaultfloat<<std::endl;
+}
+
+void saveJson(const std::string &filename)
+{
+  std::ofstream out(filename);
+  if (!out)
+  {
+    std::cout<<"Cannot write "<<filename<<std::endl;
+    exit(1);
+  }
+  out<<std::setprecision(15);
+  out<<"{\n  \"simd\": \""<<simdKernels().name<<"\",\n  \"results\": [";
+  for(size_t i = 0; i < results.size(); ++i)
+  {
+    const Result &r = results[i];
+    out<<(i ? ",\n" : "\n")<<"    {\"suite\": \""<<r.suite<<"\", \"case\": \""<<r.name<<"\", \"size\": \""<<r.size
+       <<"\", \"threads\": "<<r.threads<<", \"seconds\": "<<r.seconds
+       <<", \"points_per_second\": "<<r.pointsPerSecond<<", \"slices_per_second\": "<<r.slicesPerSecond
+       <<", \"speedup\": "<<r.speedup<<", \"checksum\": "<<r.checksum;
+    if (r.error >= 0.0)
+      out<<", \"error\": "<<r.error;
+    out<<"}";
+  }
+  out<<"\n  ]\n}\n";
+}
+
+//Sets the number of threads of the pool and of the OpenMP loops
+void setThreads(const unsigned int nbThreads)
+{
+  ThreadPool::instance().resize(nbThreads);
+  omp_set_num_threads(ThreadPool::instance().size());
+}
+
+//Fastest wall-clock time of repeat runs of run(), setup() being called
+//(untimed) before each run
+template<typename Setup, typename Run>
+double timeIt(const int repeat, Setup setup, Run run)
+{
+  double best = std::numeric_limits<double>::max();
+  for(auto r = 0; r < repeat; ++r)
+  {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+double sum(const float *values, const size_t n)
+{
+  double s = 0.0;
+  for(size_t i = 0; i < n; ++i)
+    s += values[i];
+  return s;
+}
+
+double sum(const std::vector<int> &values)
+{
+  double s = 0.0;
+  for(auto v : values)
+    s += v;
+  return s;
+}
+
+//Planar RGB image (size x size) of 8-bit values: smooth color waves plus
+//noise, quantized so that the 1D problems contain ties as real images do.
+std::vector<float> syntheticImage(const int size, const unsigned int seed)
+{
+  Generator gen(seed);
+  const size_t N = (size_t)size*size;
+  std::vector<float> image(3*N);
+  double base[3], fx[3], fy[3], phase[3];
+  for(auto k = 0; k < 3; ++k)
+  {
+    base[k]  = 64.0 + 128.0*gen.uniform();
+    fx[k]    = 2.0*M_PI*(1.0 + 4.0*gen.uniform());
+    fy[k]    = 2.0*M_PI*(1.0 + 4.0*gen.uniform());
+    phase[k] = 2.0*M_PI*gen.uniform();
+  }
+  for(size_t i = 0; i < N; ++i)
+  {
+    const double x = (double)(i % size) / size, y = (double)(i / size) / size;
+    for(auto k = 0; k < 3; ++k)
+    {
+      const double v = base[k] + 60.0*std::sin(fx[k]*x + phase[k])*std::cos(fy[k]*y) + 6.0*gen.normal();
+      image[k*N + i] = (float)std::floor(std::min(255.0, std::max(0.0, v)) + 0.5);
+    }
+  }
+  return image;
+}
+
+//Sliced 2-Wasserstein distance between two planar RGB sets of N points,
+//estimated with nbDirections gaussian directions drawn with a seed that
+//differs from the one of the transfers
+double slicedWasserstein(const float *a, const float *b, const size_t N, const int nbDirections)
+{
+  const float *channelsA[3] = {a, a + N, a + 2*N};
+  const float *channelsB[3] = {b, b + N, b + 2*N};
+  std::vector<float> projA(N), projB(N);
+  DirectionSequence directions(3, 0x5eed);
+  double sw = 0.0;
+  for(auto k = 0; k < nbDirections; ++k)
+  {
+    float dir[3];
+    directions.next(dir);
+    projectPlanar(channelsA, dir, 3, 0, N, projA.data());
+    projectPlanar(channelsB, dir, 3, 0, N, projB.data());
+    std::sort(projA.begin(), projA.end());
+    std::sort(projB.begin(), projB.end());
+    double w = 0.0;
+    for(size_t i = 0; i < N; ++i)
+      w += (double)(projA[i] - projB[i])*(projA[i] - projB[i]);
+    sw += w / N;
+  }
+  return std::sqrt(sw / nbDirections);
+}
+
+//Sorted 1D distributions of M (source) and N (target) values in [0,1].
+//uniform: both uniform; clustered: mixtures of 16 narrow gaussians with
+//different centers; adversarial: the source lies in a narrow band of the
+//target, so that all the nearest neighbors collide and the whole problem
+//is a single non-injective range.
+void distribution1d(const std::string &kind, const size_t M, const size_t N, float *source, float *target)
+{
+  Generator gen(7);
+  if (kind == "uniform")
+  {
+    for(size_t i = 0; i < M; ++i) source[i] = (float)gen.uniform();
+    for(size_t i = 0; i < N; ++i) target[i] = (float)gen.uniform();
+  }
+  else if (kind == "clustered")
+  {
+    const int nbClusters = 16;
+    double centers[2][nbClusters];
+    for(auto c = 0; c < nbClusters; ++c)
+    {
+      centers[0][c] = 0.05 + 0.9*gen.uniform();
+      centers[1][c] = 0.05 + 0.9*gen.uniform();
+    }
+    for(size_t i = 0; i < M; ++i) source[i] = (float)(centers[0][gen.engine() % nbClusters] + 0.002*gen.normal());
+    for(size_t i = 0; i < N; ++i) target[i] = (float)(centers[1][gen.engine() % nbClusters] + 0.002*gen.normal());
+  }
+  else
+  {
+    for(size_t i = 0; i < M; ++i) source[i] = (float)(0.5 + 1e-4*gen.uniform());
+    for(size_t i = 0; i < N; ++i) target[i] = (float)gen.uniform();
+  }
+  std::sort(source, source + M);
+  std::sort(target, target + N);
+}
+
+//Point clouds made of 8 gaussian clusters in [0,1]^DIM
+template<int DIM>
+std::vector<Point<DIM, float> > syntheticCloud(const size_t n, const unsigned int seed)
+{
+  Generator gen(seed);
+  const int nbClusters = 8;
+  std::vector<Point<DIM, float> > centers(nbClusters), cloud(n);
+  for(auto c = 0; c < nbClusters; ++c)
+    for(auto k = 0; k < DIM; ++k)
+      centers[c][k] = (float)(0.2 + 0.6*gen.uniform());
+  for(size_t i = 0; i < n; ++i)
+  {
+    const int c = gen.engine() % nbClusters;
+    for(auto k = 0; k < DIM; ++k)
+      cloud[i][k] = (float)(centers[c][k] + 0.05*gen.normal());
+  }
+  return cloud;
+}
+
+struct Options
+{
+  std::vector<unsigned int> threads;
+  int repeat;
+  std::vector<int> imageSizes;
+  int nbSteps;
+  int batchSize;
+  std::vector<int> transportSizes;
+  std::vector<double> nnRatios;
+  std::vector<int> scheduleSlices;
+  int errorDirections;
+  int samplingSize;
+  std::vector<double> sampleFractions;
+  double ratio;
+  int nbPoints;
+  int nbSlices;
+  int scalingPoints;
+  float sigmaXY;
+  float sigmaV;
+  bool cimg;
+};
+
+std::string squareSize(const int size)
+{
+  std::ostringstream s;
+  s<<size<<"x"<<size;
+  return s.str();
+}
+
+//End-to-end balanced sliced transfer between two synthetic images
+void benchTransfer(const Options &opt)
+{
+  for(auto size : opt.imageSizes)
+  {
+    const std::vector<float> source = syntheticImage(size, 1);
+    const std::vector<float> target = syntheticImage(size, 2);
+    const size_t N = (size_t)size*size;
+    TransferParameters params;
+    params.nbSteps = opt.nbSteps;
+    params.batchSize = opt.batchSize;
+    const int nbSlices = opt.nbSteps*opt.batchSize;
+    //The context (and its buffers) is reused by all the runs
+    TransferContext context;
+    double baseline = 0.0;
+    for(auto t : opt.threads)
+    {
+      setThreads(t);
+      std::vector<float> work;
+      const double seconds = timeIt(opt.repeat, [&]{ work = source; }, [&]{
+        context.slicedTransfer(work.data(), N, target.data(), N, params);
+      });
+      if (baseline == 0.0) baseline = seconds;
+      report("transfer", "balanced", squareSize(size), seconds, (double)N, nbSlices, baseline, sum(work.data(), 3*N));
+    }
+  }
+}
+
+//Error (sliced Wasserstein distance to the target) of the sliced transfer
+//against the number of slices, for each schedule of the directions, on
+//the smallest image size. Batches of 3 directions are used so that each
+//batch of the orthobasis schedule is an orthonormal basis of RGB.
+void benchDirections(const Options &opt)
+{
+  const int size = opt.imageSizes.front();
+  const std::vector<float> source = syntheticImage(size, 1);
+  const std::vector<float> target = syntheticImage(size, 2);
+  const size_t N = (size_t)size*size;
+  const char *schedules[3] = {"gaussian", "orthobasis", "qmc"};
+  setThreads(opt.threads.back());
+  TransferContext context;
+  for(auto schedule : schedules)
+    for(auto nbSlices : opt.scheduleSlices)
+    {
+      TransferParameters params;
+      params.batchSize = 3;
+      params.nbSteps = std::max(1, nbSlices / 3);
+      params.directions = DirectionSequence::scheduleFromName(schedule);
+      std::vector<float> work;
+      const double seconds = timeIt(opt.repeat, [&]{ work = source; }, [&]{
+        context.slicedTransfer(work.data(), N, target.data(), N, params);
+      });
+      std::ostringstream name;
+      name<<squareSize(size)<<"/"<<3*params.nbSteps;
+      const double error = slicedWasserstein(work.data(), target.data(), N, opt.errorDirections);
+      report("directions", schedule, name.str(), seconds, (double)N, 3*params.nbSteps, seconds, sum(work.data(), 3*N), error);
+    }
+}
+
+//Sampled slices: time and error (sliced Wasserstein distance to the target)
+//of the transfer for each fraction of the pixels sampled by the slices, the
+//speedup being measured against the full slices (fraction 1)
+void benchSampling(const Options &opt)
+{
+  const int size = opt.samplingSize;
+  const std::vector<float> source = syntheticImage(size, 1);
+  const std::vector<float> target = syntheticImage(size, 2);
+  const size_t N = (size_t)size*size;
+  TransferContext context;
+  for(auto t : opt.threads)
+  {
+    setThreads(t);
+    double baseline = 0.0;
+    for(auto fraction : opt.sampleFractions)
+    {
+      TransferParameters params;
+      params.nbSteps = opt.nbSteps;
+      params.batchSize = opt.batchSize;
+      params.sampleFraction = fraction;
+      std::vector<float> work;
+      const double seconds = timeIt(opt.repeat, [&]{ work = source; }, [&]{
+        context.slicedTransfer(work.data(), N, target.data(), N, params);
+      });
+      if (baseline == 0.0) baseline = seconds;
+      std::ostringstream name;
+      name<<fraction;
+      const double error = slicedWasserstein(work.data(), target.data(), N, opt.errorDirections);
+      report("sampling", name.str(), squareSize(size), seconds, (double)N, opt.nbSteps*opt.batchSize, baseline, sum(work.data(), 3*N), error);
+    }
+  }
+}
+
+//Histogram matcher against the exact (sorting) path: balanced transfers,
+//the error being the RMS difference of the two results (8-bit values), and
+//1D partial transports on sorted distributions (approximateTransport1d
+//against transport1d), the error being the ratio of their costs. The speedup is measured against
+//the exact path with the same number of threads.
+void benchMatcher(const Options &opt)
+{
+  for(auto size : opt.imageSizes)
+  {
+    const std::vector<float> source = syntheticImage(size, 1);
+    const std::vector<float> target = syntheticImage(size, 2);
+    const size_t N = (size_t)size*size;
+    TransferContext context;
+    for(auto t : opt.threads)
+    {
+      setThreads(t);
+      TransferParameters params;
+      params.nbSteps = opt.nbSteps;
+      params.batchSize = opt.batchSize;
+      std::vector<float> exact, work;
+      const double exactSeconds = timeIt(opt.repeat, [&]{ exact = source; }, [&]{
+        context.slicedTransfer(exact.data(), N, target.data(), N, params);
+      });
+      report("matcher", "sort", squareSize(size), exactSeconds, (double)N, opt.nbSteps*opt.batchSize, exactSeconds, sum(exact.data(), 3*N), 0.0);
+      params.useHistogram = true;
+      const double seconds = timeIt(opt.repeat, [&]{ work = source; }, [&]{
+        context.slicedTransfer(work.data(), N, target.data(), N, params);
+      });
+      double rms = 0.0;
+      for(size_t i = 0; i < 3*N; ++i)
+        rms += (double)(work[i] - exact[i])*(work[i] - exact[i]);
+      report("matcher", "histogram", squareSize(size), seconds, (double)N, opt.nbSteps*opt.batchSize, exactSeconds, sum(work.data(), 3*N), std::sqrt(rms/(3*N)));
+    }
+  }
+  
+  const char *kinds[2] = {"uniform", "clustered"};
+  for(auto kind : kinds)
+    for(auto M : opt.transportSizes)
+    {
+      const size_t N = (size_t)(M*opt.ratio);
+      float *source = (float*)malloc_simd(M*sizeof(float), 32);
+      float *target = (float*)malloc_simd(N*sizeof(float), 32);
+      distribution1d(kind, M, N, source, target);
+      std::ostringstream size;
+      size<<M<<"/"<<N;
+      UnbalancedSliced transport;
+      std::vector<int> assignment;
+      for(auto t : opt.threads)
+      {
+        setThreads(t);
+        double exactCost = 0.0, cost = 0.0;
+        const double exactSeconds = timeIt(opt.repeat, []{}, [&]{
+          exactCost = transport.transport1d(source, target, M, N, assignment);
+        });
+        const double seconds = timeIt(opt.repeat, []{}, [&]{
+          cost = transport.approximateTransport1d(source, target, M, N, assignment);
+        });
+        report("matcher", std::string("1d-") + kind, size.str(), seconds, (double)M, 1, exactSeconds, cost, cost/exactCost);
+      }
+      free_simd(source);
+      free_simd(target);
+    }
+}
+
+//1D unbalanced transport (M < N) on sorted distributions, followed by the
+//number of subproblems of transport1d and the share of the longest one
+void benchTransport1d(const Options &opt)
+{
+  const char *kinds[3] = {"uniform", "clustered", "adversarial"};
+  for(auto kind : kinds)
+    for(auto M : opt.transportSizes)
+    {
+      const size_t N = (size_t)(M*opt.ratio);
+      float *source = (float*)malloc_simd(M*sizeof(float), 32);
+      float *target = (float*)malloc_simd(N*sizeof(float), 32);
+      distribution1d(kind, M, N, source, target);
+      std::ostringstream size;
+      size<<M<<"/"<<N;
+      double baseline = 0.0;
+      for(auto t : opt.threads)
+      {
+        setThreads(t);
+        UnbalancedSliced transport;
+        std::vector<int> assignment;
+        double cost = 0.0;
+        const double seconds = timeIt(opt.repeat, []{}, [&]{
+          cost = transport.transport1d(source, target, M, N, assignment);
+        });
+        if (baseline == 0.0) baseline = seconds;
+        report("transport1d", kind, size.str(), seconds, (double)M, 1, baseline, cost);
+      }
+      //Subproblems of the decomposition: the longest one bounds the parallel time
+      std::vector<double> splits;
+      UnbalancedSliced transport;
+      std::vector<int> assignment;
+      transport.transport1d(source, target, M, N, assignment, &splits, false);
+      double total = 0.0, longest = 0.0;
+      for(auto t : splits)
+      {
+        total += t;
+        longest = std::max(longest, t);
+      }
+      std::cout<<"  subproblems: "<<splits.size()<<", longest "<<std::fixed<<std::setprecision(2)<<1000.0*longest
+               <<" ms ("<<(total > 0.0 ? 100.0*longest/total : 0.0)<<"% of their time)"<<std::defaultfloat<<std::endl;
+      free_simd(source);
+      free_simd(target);
+    }
+}
+
+//1D nearest neighbors of transport1d: galloping and AVX compares
+//(nearest_neighbor_match) against the linear scan, on sorted distributions
+//with N/M from 1 to 64, the speedup being measured against the scan with the
+//same number of threads and the error being the fraction of the matches
+//that differ from the scan ones
+void benchNearestNeighbors(const Options &opt)
+{
+  const char *kinds[2] = {"uniform", "clustered"};
+  for(auto kind : kinds)
+    for(auto ratio : opt.nnRatios)
+      for(auto M : opt.transportSizes)
+      {
+        const size_t N = (size_t)(M*ratio);
+        float *source = (float*)malloc_simd(M*sizeof(float), 32);
+        float *target = (float*)malloc_simd(N*sizeof(float), 32);
+        distribution1d(kind, M, N, source, target);
+        std::ostringstream size;
+        size<<M<<"/"<<N;
+        UnbalancedSliced transport;
+        const params p(0, M, 0, (int)N, 0);
+        std::vector<int> scan(M), match(M);
+        for(auto t : opt.threads)
+        {
+          setThreads(t);
+          const double scanSeconds = timeIt(opt.repeat, []{}, [&]{
+            transport.nearest_neighbor_match_scan(source, target, p, &scan[0]);
+          });
+          report("nn", std::string(kind) + "/scan", size.str(), scanSeconds, (double)M, 0, scanSeconds, sum(scan));
+          const double seconds = timeIt(opt.repeat, []{}, [&]{
+            transport.nearest_neighbor_match(source, target, p, &match[0]);
+          });
+          size_t mismatches = 0;
+          for(auto i = 0; i < M; ++i)
+            mismatches += (scan[i] != match[i]);
+          report("nn", std::string(kind) + "/gallop", size.str(), seconds, (double)M, 0, scanSeconds, sum(match), (double)mismatches/M);
+        }
+        free_simd(source);
+        free_simd(target);
+      }
+}
+
+//Sliced partial transport of DIM-dimensional clouds (advected source)
+template<int DIM>
+void benchCorrespondencesNd(const Options &opt)
+{
+  const std::vector<Point<DIM, float> > source = syntheticCloud<DIM>(opt.nbPoints, 3);
+  const std::vector<Point<DIM, float> > target = syntheticCloud<DIM>((size_t)(opt.nbPoints*opt.ratio), 4);
+  std::ostringstream name, size;
+  name<<"dim"<<DIM;
+  size<<source.size()<<"/"<<target.size();
+  TransferContext context;
+  TransferParameters params;
+  params.nbSteps = opt.nbSlices;
+  double baseline = 0.0;
+  for(auto t : opt.threads)
+  {
+    setThreads(t);
+    std::vector<Point<DIM, float> > work;
+    double distance = 0.0;
+    const double seconds = timeIt(opt.repeat, [&]{ work = source; }, [&]{
+      distance = context.correspondencesNd(work, target, params, true);
+    });
+    if (baseline == 0.0) baseline = seconds;
+    report("nd", name.str(), size.str(), seconds, (double)source.size()*opt.nbSlices, opt.nbSlices, baseline, distance);
+  }
+}
+
+//Checks the slice directions of the nd dimensions above 4 (several Philox
+//blocks) and above 64, for each schedule: each direction must be of unit
+//norm, the components of the gaussian directions must not repeat those of
+//the previous block, and the directions of an orthonormal basis must be
+//orthogonal (returns false otherwise)
+bool checkDirections()
+{
+  bool ok = true;
+  for(auto schedule : {"gaussian", "orthobasis", "qmc"})
+    for(auto dim : {5, 8, 16, 80})
+    {
+      DirectionSequence directions(dim, DirectionSequence::DEFAULT_SEED, DirectionSequence::scheduleFromName(schedule));
+      const int nbDirections = std::max(64, 2*dim);
+      std::vector<double> dirs((size_t)nbDirections*dim);
+      for(auto k = 0; k < nbDirections; ++k)
+      {
+        const double *dir = &dirs[(size_t)k*dim];
+        directions.next(&dirs[(size_t)k*dim]);
+        double norm = 0.0, dot = 0.0;
+        bool repeated = false;
+        for(auto i = 0; i < dim; ++i)
+        {
+          norm += dir[i]*dir[i];
+          repeated = repeated || ((i >= 4) && (dir[i] == dir[i - 4]));
+        }
+        //largest dot product with the previous directions of the same basis
+        if (std::string(schedule) == "orthobasis")
+          for(auto j = k - k % dim; j < k; ++j)
+          {
+            double d = 0.0;
+            for(auto i = 0; i < dim; ++i)
+              d += dir[i]*dirs[(size_t)j*dim + i];
+            dot = std::max(dot, std::abs(d));
+          }
+        if ((std::abs(norm - 1.0) > 1e-9) || (dot > 1e-9) || (repeated && (std::string(schedule) == "gaussian")))
+        {
+          std::cout<<schedule<<" direction "<<k<<" in dimension "<<dim<<": squared norm "<<norm
+                   <<", dot product "<<dot<<(repeated ? ", repeated components" : "")<<std::endl;
+          ok = false;
+          break;
+        }
+      }
+    }
+  return ok;
+}
+
+//Thread scaling of the phases of the slices of correspondencesNd on a
+//partial color transfer (RGB clouds, the target being ratio times larger),
+//with the radix sort and with std::sort: the time of each phase is the
+//one measured by the profiler over all the slices, the speedup being
+//measured against the first thread count. The checksum is the one of the
+//advected cloud.
+void benchScaling(const Options &opt)
+{
+  const std::vector<Point<3, float> > source = syntheticCloud<3>(opt.scalingPoints, 5);
+  const std::vector<Point<3, float> > target = syntheticCloud<3>((size_t)(opt.scalingPoints*opt.ratio), 6);
+  std::ostringstream size;
+  size<<source.size()<<"/"<<target.size();
+  const char *phases[5] = {"projection", "sort", "copy", "transport1d", "advection"};
+  const char *sorts[2] = {"radix", "stdsort"};
+  Profiler &profiler = Profiler::instance();
+  profiler.enable();
+  for(auto sort : sorts)
+  {
+    TransferContext context;
+    TransferParameters params;
+    params.nbSteps = opt.nbSlices;
+    params.useStdSort = (std::string(sort) == "stdsort");
+    std::vector<double> baselines;
+    for(auto t : opt.threads)
+    {
+      setThreads(t);
+      std::vector<Point<3, float> > work;
+      std::vector<double> best(5, std::numeric_limits<double>::max());
+      const double seconds = timeIt(opt.repeat, [&]{ work = source; profiler.reset(); }, [&]{
+        context.correspondencesNd(work, target, params, true);
+        for(auto p = 0; p < 5; ++p)
+          best[p] = std::min(best[p], profiler.seconds(phases[p]));
+      });
+      double checksum = 0.0;
+      for(size_t i = 0; i < work.size(); ++i)
+        checksum += (double)work[i][0] + work[i][1] + work[i][2];
+      if (baselines.empty())
+      {
+        baselines = best;
+        baselines.push_back(seconds);
+      }
+      for(auto p = 0; p < 5; ++p)
+        if (best[p] > 0.0)
+          report("scaling", std::string(sort) + "/" + phases[p], size.str(), best[p], (double)source.size()*opt.nbSlices, opt.nbSlices, baselines[p], checksum);
+      report("scaling", std::string(sort) + "/total", size.str(), seconds, (double)source.size()*opt.nbSlices, opt.nbSlices, baselines[5], checksum);
+    }
+  }
+  profiler.enable(false);
+}
+
+//Tolerance of the bilateral grid against CImg::blur_bilateral (8-bit values):
+//mean absolute difference and fraction of the values within 1
+const double bilateralMaxMAE = 0.25;
+const double bilateralMinWithin1 = 0.99;
+
+//Bilateral regularization of a transport field (difference of two synthetic images).
+//The error of the grid is its mean absolute difference to CImg::blur_bilateral,
+//which is checked against the tolerance above (returns false if exceeded).
+bool benchBilateral(const Options &opt)
+{
+  bool ok = true;
+  for(auto size : opt.imageSizes)
+  {
+    std::vector<float> field = syntheticImage(size, 2);
+    const std::vector<float> source = syntheticImage(size, 1);
+    const size_t N = (size_t)size*size;
+    for(size_t i = 0; i < 3*N; ++i)
+      field[i] -= source[i];
+    
+    //CImg::blur_bilateral is single-threaded ; only timed with --cimg
+    setThreads(1);
+    cimg_library::CImg<float> reference;
+    const auto cimgRun = [&]{ reference.blur_bilateral(reference, opt.sigmaXY, opt.sigmaV); };
+    const auto cimgInit = [&]{ reference.assign(field.data(), size, size, 1, 3); };
+    double cimgSeconds = 0.0;
+    if (opt.cimg)
+      cimgSeconds = timeIt(opt.repeat, cimgInit, cimgRun);
+    else
+    {
+      cimgInit();
+      cimgRun();
+    }
+    
+    double baseline = 0.0;
+    for(auto t : opt.threads)
+    {
+      setThreads(t);
+      std::vector<float> work;
+      const double seconds = timeIt(opt.repeat, [&]{ work = field; }, [&]{
+        BilateralGrid::filterPlanar(work.data(), size, size, 3, opt.sigmaXY, opt.sigmaV);
+      });
+      if (baseline == 0.0) baseline = seconds;
+      double mae = 0.0, maxDiff = 0.0;
+      size_t within1 = 0;
+      for(size_t i = 0; i < 3*N; ++i)
+      {
+        const double d = std::abs((double)work[i] - reference.data()[i]);
+        mae += d;
+        maxDiff = std::max(maxDiff, d);
+        within1 += (d <= 1.0);
+      }
+      mae /= 3.0*N;
+      report("bilateral", "grid", squareSize(size), seconds, (double)N, 0, baseline, sum(work.data(), 3*N), mae);
+      if ((mae > bilateralMaxMAE) || (within1 < bilateralMinWithin1*3.0*N))
+      {
+        std::cout<<"bilateral grid vs cimg ("<<squareSize(size)<<"): mean absolute difference "<<mae<<", max "<<maxDiff
+                 <<", "<<100.0*within1/(3.0*N)<<"% within 1, out of the tolerance (mean <= "<<bilateralMaxMAE
+                 <<", "<<100.0*bilateralMinWithin1<<"% within 1)"<<std::endl;
+        ok = false;
+      }
+    }
+    
+    if (opt.cimg)
+      report("bilateral", "cimg", squareSize(size), cimgSeconds, (double)N, 0, cimgSeconds, sum(reference.data(), 3*N));
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  CLI::App app{"benchmarks"};
+  Options opt;
+  std::vector<std::string> suites = {"transfer", "directions", "sampling", "matcher", "transport1d", "nn", "nd", "scaling", "bilateral"};
+  app.add_option("--suites", suites, "Benchmarks to run (transfer directions sampling matcher transport1d nn nd scaling bilateral)")->check(CLI::IsMember({"transfer", "directions", "sampling", "matcher", "transport1d", "nn", "nd", "scaling", "bilateral"}));
+  opt.threads = {1, std::max(1u, std::thread::hardware_concurrency())};
+  app.add_option("--threads", opt.threads, "Thread counts to run each case with (1 and all cores)");
+  opt.repeat = 3;
+  app.add_option("--repeat", opt.repeat, "Number of runs of each case, the fastest one is reported (3)");
+  int minSize = 256, maxSize = 2048;
+  app.add_option("--min-size", minSize, "Smallest synthetic image size (256)");
+  app.add_option("--max-size", maxSize, "Largest synthetic image size, sizes are doubled from min-size (2048, 8192 needs about 8GB)");
+  opt.nbSteps = 8;
+  app.add_option("-n,--nbsteps", opt.nbSteps, "Number of sliced steps of the transfer benchmark (8)");
+  opt.batchSize = 1;
+  app.add_option("-b,--sizeBatch", opt.batchSize, "Number of directions on a batch of the transfer benchmark (1)");
+  opt.scheduleSlices = {3, 6, 12, 24, 48, 96};
+  app.add_option("--schedule-slices", opt.scheduleSlices, "Slice counts of the direction schedule benchmark, rounded to multiples of 3 (3 6 12 24 48 96)");
+  opt.errorDirections = 256;
+  app.add_option("--error-directions", opt.errorDirections, "Number of directions of the sliced Wasserstein error estimate (256)");
+  opt.samplingSize = 512;
+  app.add_option("--sampling-size", opt.samplingSize, "Synthetic image size of the sampled slices benchmark (512)");
+  opt.sampleFractions = {1.0, 0.25, 0.1, 0.05, 0.01};
+  app.add_option("--sample-fractions", opt.sampleFractions, "Fractions of the pixels sampled by the slices, the first one being the reference of the speedup (1 0.25 0.1 0.05 0.01)");
+  opt.transportSizes = {1 << 14, 1 << 16, 1 << 18};
+  app.add_option("--transport-sizes", opt.transportSizes, "Source sizes M of the 1D transport benchmark (16384 65536 262144)");
+  opt.nnRatios = {1.0, 1.5, 16.0, 64.0};
+  app.add_option("--nn-ratios", opt.nnRatios, "Target to source size ratios N/M of the nearest neighbors benchmark (1 1.5 16 64)")->check(CLI::Range(1.0, 1000.0));
+  opt.ratio = 1.5;
+  app.add_option("--ratio", opt.ratio, "Target to source size ratio N/M of the unbalanced benchmarks (1.5)")->check(CLI::Range(1.0, 100.0));
+  opt.nbPoints = 1 << 15;
+  app.add_option("--points", opt.nbPoints, "Number of source points of the correspondencesNd benchmark (32768)");
+  opt.nbSlices = 16;
+  app.add_option("--slices", opt.nbSlices, "Number of slices of the correspondencesNd benchmark (16)");
+  opt.scalingPoints = 1280*1024;
+  app.add_option("--scaling-points", opt.scalingPoints, "Number of source points of the thread scaling benchmark (1310720)");
+  opt.sigmaXY = 16.0f;
+  app.add_option("--sigmaXY", opt.sigmaXY, "Spatial sigma of the bilateral benchmark (16.0)");
+  opt.sigmaV = 5.0f;
+  app.add_option("--sigmaV", opt.sigmaV, "Value sigma of the bilateral benchmark (5.0)");
+  opt.cimg = false;
+  app.add_flag("--cimg", opt.cimg, "Also time CImg::blur_bilateral, single-threaded (false)");
+  std::string jsonFile;
+  app.add_option("--json", jsonFile, "Export the results to a JSON file");
+  CLI11_PARSE(app, argc, argv);
+  
+  std::sort(opt.threads.begin(), opt.threads.end());
+  opt.threads.erase(std::unique(opt.threads.begin(), opt.threads.end()), opt.threads.end());
+  for(auto size = minSize; size <= maxSize; size *= 2)
+    opt.imageSizes.push_back(size);
+  
+  std::cout<<"SIMD kernels: "<<simdKernels().name<<std::endl;
+  std::cout<<std::left<<std::setw(12)<<"suite"<<std::setw(22)<<"case"<<std::setw(16)<<"size"
+           <<std::right<<std::setw(4)<<"thr"<<std::setw(12)<<"time(ms)"<<std::setw(12)<<"Mpoints/s"
+           <<std::setw(12)<<"slices/s"<<std::setw(9)<<"speedup"<<std::setw(20)<<"checksum"<<std::setw(14)<<"error"<<std::endl;
+  
+  auto selected = [&](const std::string &suite) {
+    return std::find(suites.begin(), suites.end(), suite) != suites.end();
+  };
+  if (selected("transfer"))
+    benchTransfer(opt);
+  if (selected("directions"))
+    benchDirections(opt);
+  if (selected("sampling"))
+    benchSampling(opt);
+  if (selected("matcher"))
+    benchMatcher(opt);
+  if (selected("transport1d"))
+    benchTransport1d(opt);
+  if (selected("nn"))
+    benchNearestNeighbors(opt);
+  bool ok = true;
+  if (selected("nd"))
+  {
+    ok = checkDirections() && ok;
+    benchCorrespondencesNd<3>(opt);
+    benchCorrespondencesNd<4>(opt);
+    benchCorrespondencesNd<6>(opt);
+    benchCorrespondencesNd<8>(opt);
+    benchCorrespondencesNd<12>(opt);
+    benchCorrespondencesNd<16>(opt);
+  }
+  if (selected("scaling"))
+    benchScaling(opt);
+  if (selected("bilateral"))
+    ok = benchBilateral(opt) && ok;
+  
+  if (!jsonFile.empty())
+    saveJson(jsonFile);
+  exit(ok ? 0 : 1);
+}
@@ -31,7 +31,20 @@
 #include <vector>
 #include <chrono>
 #include <ctime>
+#include <cstdio>
 #include <thread>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <csignal>
+#include <exception>
+#ifndef _WIN32
+#include <poll.h>
+#endif
 //Command-line parsing
 #include "CLI11.hpp"
 
@@ -43,191 +56,940 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "UnbalancedSliced/ThreadPool.h"
+#include "UnbalancedSliced/TargetProjections.h"
+#include "UnbalancedSliced/ColorLattice.h"
+#include "UnbalancedSliced/CubeLut.h"
+#include "UnbalancedSliced/BilateralGrid.h"
+#include "UnbalancedSliced/Profiler.h"
+#include "UnbalancedSliced/TransferContext.h"
+#ifndef _WIN32
+#include "UnbalancedSliced/JobProtocol.h"
+#endif
+
 //Global flag to silent verbose messages
 bool silent;
+//Global flag to use std::sort instead of the radix sort
+bool stdSort;
+
+//Collapse an 8-bit image into its set of unique RGB triplets.
+//colors: planar RGB values of the unique colors, weights: number of pixels
+//sharing that color, index: for each pixel, the id of its unique color
+void uniqueColors(const unsigned char *image,
+                  const int nbPixels,
+                  const int nbChannels,
+                  std::vector<float> &colors,
+                  std::vector<float> &weights,
+                  std::vector<unsigned int> &index)
+{
+  //Dense RGB24 -> unique id table
+  std::vector<int> lut(1<<24, -1);
+  std::vector<float> channels[3];
+  weights.clear();
+  index.resize(nbPixels);
+  for(auto i = 0; i < nbPixels; ++i)
+  {
+    const unsigned char *pix = image + nbChannels*i;
+    unsigned int key = (pix[0]<<16) | (pix[1]<<8) | pix[2];
+    if (lut[key] < 0)
+    {
+      lut[key] = weights.size();
+      for(auto k = 0; k < 3; ++k)
+        channels[k].push_back(pix[k]);
+      weights.push_back(0.0);
+    }
+    weights[lut[key]] += 1.0;
+    index[i] = lut[key];
+  }
+  colors.clear();
+  for(auto k = 0; k < 3; ++k)
+    colors.insert(colors.end(), channels[k].begin(), channels[k].end());
+}
+
+//Converts an interleaved 8-bit image to planar floats (one array per channel)
+void toPlanar(const unsigned char *image,
+              const int nbPixels,
+              const int nbChannels,
+              std::vector<float> &planar)
+{
+  planar.resize(nbChannels*nbPixels);
+  ThreadPool::instance().parallelFor(nbPixels, [&](size_t begin, size_t end) {
+    for(auto k = 0; k < nbChannels; ++k)
+      for(auto i = begin; i < end; ++i)
+        planar[k*nbPixels + i] = static_cast<float>(image[nbChannels*i + k]);
+  });
+}
 
-void slicedTransfer(std::vector<float> &source,
-                    const std::vector<float> &target,
-                    const int nbSteps,
-                    const int batchSize,
-                    const double factor)
+//Downsamples the first three channels of a planar image by 2^levels in
+//each direction (moving average). The CImg layout is planar as well.
+std::vector<float> downsample(const std::vector<float> &planar,
+                              const int width,
+                              const int height,
+                              const int levels,
+                              int &coarseWidth,
+                              int &coarseHeight)
 {
-  //Random generator init to draw random line directions
-  std::mt19937 gen;
-  gen.seed(10);
-  std::normal_distribution<float> dist{0.0,1.0};
+  coarseWidth  = std::max(1, width >> levels);
+  coarseHeight = std::max(1, height >> levels);
+  cimg_library::CImg<float> image(planar.data(), width, height, 1, 3);
+  image.resize(coarseWidth, coarseHeight, 1, 3, 2);
+  return std::vector<float>(image.data(), image.data() + 3*coarseWidth*coarseHeight);
+}
+
+//Coarse-to-fine transfer: the sliced flow is computed on images downsampled
+//by 2^levels, and the coarse displacements are lifted to the full resolution
+//source by a 3D color lattice (no full resolution sort).
+int pyramidTransfer(std::vector<float> &source,
+                     const int width,
+                     const int height,
+                     const std::vector<float> &target,
+                     const int widthTarget,
+                     const int heightTarget,
+                     const int levels,
+                     const int latticeSize,
+                     TransferContext &context,
+                     const TransferParameters &params,
+                     const TargetProjections *targetProj)
+{
+  auto start = std::chrono::system_clock::now();
+  
+  int cw, ch, cwt = 0, cht = 0;
+  std::vector<float> coarse, coarseTarget;
+  {
+    Profiler::Scope scope("downsampling");
+    coarse = downsample(source, width, height, levels, cw, ch);
+    if (!targetProj)
+      coarseTarget = downsample(target, widthTarget, heightTarget, levels, cwt, cht);
+  }
+  const size_t Nc = cw*ch;
+  if (!silent) std::cout<<"Pyramid level "<<levels<<": "<<cw<<"x"<<ch<<" (source) "<<cwt<<"x"<<cht<<" (target)"<<std::endl;
   
-  auto N = source.size()/3;
+  std::vector<float> transported(coarse);
+  const int steps = context.slicedTransfer(transported.data(), Nc, coarseTarget.data(), cwt*cht, params, targetProj);
   
-  //Advection vector
-  std::vector<float> advect(3*N, 0.0);
+  auto mid = std::chrono::system_clock::now();
   
-  //To store the 1D projections
-  std::vector<float> projsource(N);
-  std::vector<float> projtarget(N);
+  //Coarse displacements, lifted by the color lattice
+  Profiler::Scope scope("lattice");
+  for(auto i = 0; i < 3*Nc; ++i)
+    transported[i] -= coarse[i];
+  const float *coarseChannels[3] = {&coarse[0], &coarse[Nc], &coarse[2*Nc]};
+  const float *dispChannels[3] = {&transported[0], &transported[Nc], &transported[2*Nc]};
+  ColorLattice lattice(latticeSize);
+  lattice.fit(coarseChannels, dispChannels, Nc);
+  const size_t N = width*height;
+  float *sourceChannels[3] = {&source[0], &source[N], &source[2*N]};
+  lattice.apply(sourceChannels, N);
   
-  //Pixel Id
-  std::vector<unsigned int> idSource(N);
-  std::vector<unsigned int> idTarget(N);
+  auto end = std::chrono::system_clock::now();
+  std::chrono::duration<double> coarseTime = mid - start, liftTime = end - mid;
+  if (!silent) std::cout<<"Coarse solve: "<<coarseTime.count()<<"s, lattice lift: "<<liftTime.count()<<"s"<<std::endl;
+  return steps;
+}
+
+//Regularization of the transport plan: bilateral filter of the difference
+//between the transported colors (planar) and the source image (interleaved)
+void regularize(std::vector<float> &sourcefloat,
+                const unsigned char *source,
+                const int width,
+                const int height,
+                const int nbChannels,
+                const float sigmaXY,
+                const float sigmaV,
+                const std::string &regularizer)
+{
+  const int N = width*height;
+  cimg_library::CImg<float> transport(width, height, 1, 3);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i=0; i<N; ++i)
+      transport[i + k*N] = sourcefloat[i + k*N] - static_cast<float>(source[nbChannels*i+k]);
+  if (regularizer == "cimg")
+    transport.blur_bilateral(transport, sigmaXY,sigmaV);
+  else
+    BilateralGrid::filterPlanar(transport.data(), width, height, 3, sigmaXY, sigmaV);
   
-  //Lambda expression for the comparison of points in RGB
-  //according to their projections
-  auto lambdaProjSource = [&projsource](unsigned int a, unsigned int b) {return projsource[a] < projsource[b]; };
-  auto lambdaProjTarget = [&projtarget](unsigned int a, unsigned int b) {return projtarget[a] < projtarget[b]; };
+  for(auto k = 0; k < 3; ++k)
+    for(auto i=0; i<N; ++i)
+      sourcefloat[i + k*N] = static_cast<float>(source[nbChannels*i+k]) + transport[i + k*N];
+}
+
+//Converts a planar float result to an interleaved 8-bit image (clamped values)
+void toImage(const std::vector<float> &planar,
+             const int nbPixels,
+             const int nbChannels,
+             std::vector<unsigned char> &image)
+{
+  image.resize(nbChannels*nbPixels);
+  for(auto k = 0; k < nbChannels; ++k)
+    for(auto i = 0 ; i < nbPixels ; ++i)
+      image[nbChannels*i+k] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f,  planar[k*nbPixels+i])));
+}
+
+//Name of the intermediate image of a progressive transfer after the given number of
+//steps: the step count is inserted before the extension (output-0010.png)
+std::string progressiveName(const std::string &output, const int steps)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%04d", steps);
+  const size_t dot = output.find_last_of('.');
+  const size_t slash = output.find_last_of("/\\");
+  if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+    return output + suffix;
+  return output.substr(0, dot) + suffix + output.substr(dot);
+}
+
+#ifndef _WIN32
+//Server mode: the targets are decoded once and kept in memory, together with
+//their sorted projections, and jobs are read from a Unix socket.
+
+//Target kept in memory by the server
+struct WarmTarget
+{
+  int width;
+  int height;
+  //Planar RGB values
+  std::vector<float> planar;
+  //Sorted projections (or quantile knots) along the first directions
+  TargetProjections projections;
+};
+
+volatile sig_atomic_t serverStopping = 0;
+void stopServer(int) { serverStopping = 1; }
+
+class TransferServer
+{
+public:
+  TransferServer(const unsigned int nbDirections,
+                 const unsigned int nbQuantiles,
+                 const uint64_t seed,
+                 const DirectionSequence::Schedule schedule,
+                 const std::string &regularizer,
+                 const unsigned int idleMs)
+  : nbDirections(nbDirections), nbQuantiles(nbQuantiles), seed(seed), schedule(schedule), regularizer(regularizer), idleMs(idleMs), stopping(false)
+  {}
   
-  for(auto i=0; i < idSource.size() ; ++i)
+  //Decodes a target image and precomputes its projections (an existing id is replaced)
+  bool registerTarget(const std::string &id, const std::string &path, std::string &error)
   {
-    idSource[i]=i;
-    idTarget[i]=i;
+    int width, height, nbChannels;
+    unsigned char *image = stbi_load(path.c_str(), &width, &height, &nbChannels, 0);
+    if (!image || nbChannels < 3)
+    {
+      error = image ? "Input images must be color images." : "Cannot decode " + path;
+      stbi_image_free(image);
+      return false;
+    }
+    std::shared_ptr<WarmTarget> target = std::make_shared<WarmTarget>();
+    target->width = width;
+    target->height = height;
+    const size_t M = width*height;
+    toPlanar(image, M, nbChannels, target->planar);
+    target->planar.resize(3*M);
+    stbi_image_free(image);
+    
+    const float *channels[3] = {&target->planar[0], &target->planar[M], &target->planar[2*M]};
+    TransferContext context;
+    context.precomputeTarget(channels, M, nbDirections, nbQuantiles, target->projections, seed, schedule);
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    targets[id] = target;
+    return true;
   }
   
-  for(auto step =0 ; step < nbSteps; ++step)
+  //Serves the jobs until SIGINT or SIGTERM, nbJobs jobs being processed concurrently
+  void run(const std::string &socketPath, const unsigned int nbJobs)
   {
-    for(auto batch = 0; batch < batchSize; ++batch )
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    const int listenFd = listenUnixSocket(socketPath);
+    if (listenFd < 0)
     {
-      //Random direction
-      float dirx = dist(gen);
-      float diry = dist(gen);
-      float dirz = dist(gen);
-      float norm = sqrt(dirx*dirx + diry*diry + dirz*dirz);
-      dirx /= norm;
-      diry /= norm;
-      dirz /= norm;
-      if (!silent) std::cout<<"Slice "<<step<<" batch "<<batch<<"  "<<dirx<<","<<diry<<","<<dirz<<std::endl;
-      
-      //We project the points
-      for(auto i = 0; i < projsource.size(); ++i)
+      std::cout<<"Cannot listen on "<<socketPath<<std::endl;
+      exit(1);
+    }
+    if (!silent) std::cout<<"Serving on "<<socketPath<<" ("<<nbJobs<<" concurrent jobs, "<<ThreadPool::instance().size()<<" threads)"<<std::endl;
+    
+    //Each job thread owns a context, whose buffers are reused from one job to the next,
+    //the transfers themselves run on the shared thread pool
+    std::vector<std::thread> jobThreads;
+    for(auto j = 0; j < nbJobs; ++j)
+      jobThreads.push_back(std::thread([this] { jobLoop(); }));
+    
+    while (!serverStopping)
+    {
+      pollfd pfd = {listenFd, POLLIN, 0};
+      if (poll(&pfd, 1, 200) <= 0)
+        continue;
+      const int fd = accept(listenFd, NULL, NULL);
+      if (fd < 0)
+        continue;
+      std::unique_lock<std::mutex> lock(mutex);
+      pending.push_back(fd);
+      cond.notify_one();
+    }
+    
+    close(listenFd);
+    unlink(socketPath.c_str());
+    {
+      //Idle connections are closed, jobs in progress are completed
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+      for(auto fd : active)
+        shutdown(fd, SHUT_RD);
+      cond.notify_all();
+    }
+    for(auto &t : jobThreads)
+      t.join();
+    if (!silent) std::cout<<"Server stopped"<<std::endl;
+  }
+  
+private:
+  
+  void jobLoop()
+  {
+    TransferContext context;
+    std::unique_ptr<JobChannel> channel;
+    for(;;)
+    {
+      int fd;
       {
-        projsource[i] = dirx * source[3*i] + diry * source[3*i+1] + dirz * source[3*i+2];
-        projtarget[i] = dirx * target[3*i] + diry * target[3*i+1] + dirz * target[3*i+2];
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+          return;
+        fd = pending.front();
+        pending.pop_front();
+        active.insert(fd);
       }
       
-      //1D optimal transport of the projections with two sorts
-      std::thread threadA([&]{ std::sort(idSource.begin(), idSource.end(), lambdaProjSource); });
-      std::sort(idTarget.begin(), idTarget.end(), lambdaProjTarget);
-      threadA.join();
+      //A connection carries any number of jobs ; it is closed when its client stays
+      //idle for idleMs, so that idle clients do not hold the job threads. A malformed
+      //request gets an error reply and closes the connection. A job failing with an
+      //exception gets an error reply, the server going on.
+      channel.reset(new JobChannel(fd, idleMs));
+      JobMessage request;
+      for(;;)
+      {
+        JobMessage reply;
+        bool received = false;
+        try
+        {
+          received = channel->read(request);
+          if (received)
+            handle(request, reply, context);
+        }
+        catch (const std::exception &e)
+        {
+          reply.fields.clear();
+          reply.payload.clear();
+          reply.set("status", "error");
+          reply.set("message", std::string("Job failed: ") + e.what());
+        }
+        if (!received && reply.fields.empty())
+        {
+          if (!channel->error().empty())
+          {
+            reply.set("status", "error");
+            reply.set("message", channel->error());
+            channel->write(reply);
+          }
+          break;
+        }
+        if (!channel->write(reply) || !received)
+          break;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping)
+          break;
+      }
       
-      //We accumulate the displacements in a batch
-      for(auto i = 0; i < idSource.size(); ++i)
+      std::unique_lock<std::mutex> lock(mutex);
+      active.erase(fd);
+      close(fd);
+    }
+  }
+  
+  void handle(const JobMessage &request, JobMessage &reply, TransferContext &context)
+  {
+    const std::string cmd = request.get("cmd", "transfer");
+    std::string error;
+    reply.set("status", "ok");
+    if (cmd == "transfer")
+    {
+      if (!transfer(request, reply, context, error))
       {
-        auto pix = idSource[i];
-        advect[3*pix]   += dirx * (projtarget[idTarget[i]] - projsource[idSource[i]]);
-        advect[3*pix+1] += diry * (projtarget[idTarget[i]] - projsource[idSource[i]]);
-        advect[3*pix+2] += dirz * (projtarget[idTarget[i]] - projsource[idSource[i]]);
+        reply.set("status", "error");
+        reply.set("message", error);
+        reply.payload.clear();
       }
     }
+    else if (cmd == "register")
+    {
+      if (!registerTarget(request.get("id"), request.get("path"), error))
+      {
+        reply.set("status", "error");
+        reply.set("message", error);
+      }
+      else if (!silent)
+        log("registered target " + request.get("id") + " (" + request.get("path") + ")");
+    }
+    else if (cmd == "targets")
+    {
+      std::string ids;
+      std::unique_lock<std::mutex> lock(mutex);
+      for(auto &t : targets)
+        ids += (ids.empty() ? "" : ",") + t.first;
+      reply.set("targets", ids);
+    }
+    else if (cmd != "ping")
+    {
+      reply.set("status", "error");
+      reply.set("message", "Unknown command " + cmd);
+    }
+  }
+  
+  static void appendBytes(void *context, void *data, int size)
+  {
+    std::vector<unsigned char> *bytes = static_cast<std::vector<unsigned char>*>(context);
+    bytes->insert(bytes->end(), (unsigned char*)data, (unsigned char*)data + size);
+  }
+  
+  bool transfer(const JobMessage &request, JobMessage &reply, TransferContext &context, std::string &error)
+  {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<const WarmTarget> target;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto it = targets.find(request.get("target"));
+      if (it != targets.end())
+        target = it->second;
+    }
+    if (!target)
+    {
+      error = "Unknown target " + request.get("target");
+      return false;
+    }
     
-    //Advection
-    for(auto i = 0; i <3*N; ++i)
+    //Source image, sent as an encoded file or read from a path
+    int width, height, nbChannels;
+    unsigned char *source = NULL;
+    if (!request.payload.empty())
+      source = stbi_load_from_memory(request.payload.data(), request.payload.size(), &width, &height, &nbChannels, 0);
+    else if (request.has("source"))
+      source = stbi_load(request.get("source").c_str(), &width, &height, &nbChannels, 0);
+    if (!source || nbChannels < 3)
     {
-      source[i] += factor*advect[i]/(float)batchSize;
-      advect[i] = 0.0;
+      error = source ? "Input images must be color images." : "Cannot decode the source image";
+      stbi_image_free(source);
+      return false;
     }
+    
+    TransferParameters params;
+    params.nbSteps = (int)request.getNumber("nbsteps", 3);
+    params.batchSize = (int)request.getNumber("batch", 1);
+    params.factor = request.getNumber("factor", 1.0);
+    params.tolerance = request.getNumber("tol", 0.0);
+    const double budget = request.getNumber("budgetms", 0.0)/1000.0;
+    if ((params.tolerance > 0.0) || (budget > 0.0))
+      params.nbSteps = (int)request.getNumber("maxsteps", 100);
+    if (budget > 0.0)
+    {
+      //The budget of a job starts at its reception
+      std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+      params.timeBudget = std::max(1e-6, budget - spent.count());
+    }
+    params.seed = request.has("seed") ? strtoull(request.get("seed").c_str(), NULL, 10) : seed;
+    params.directions = request.has("directions") ? DirectionSequence::scheduleFromName(request.get("directions")) : schedule;
+    params.sampleFraction = request.getNumber("sample", 1.0);
+    params.useHistogram = (request.get("matcher") == "histogram") && (params.sampleFraction == 1.0);
+    if ((params.nbSteps < 1) || (params.batchSize < 1))
+    {
+      error = "nbsteps and batch must be positive";
+      stbi_image_free(source);
+      return false;
+    }
+    if ((params.sampleFraction <= 0.0) || (params.sampleFraction > 1.0))
+    {
+      error = "sample must be in (0, 1]";
+      stbi_image_free(source);
+      return false;
+    }
+    
+    //The precomputed projections are used when they hold enough directions of the
+    //requested seed and schedule, otherwise the (decoded) target is projected and sorted for each slice
+    const int N = width*height;
+    const size_t M = target->width*target->height;
+    const bool warm = ((size_t)params.nbSteps*params.batchSize <= target->projections.nbDirections) &&
+                      (params.seed == target->projections.seed) && (params.directions == schedule);
+    params.nbQuantiles = warm ? 0 : nbQuantiles;
+    std::vector<float> sourcefloat;
+    toPlanar(source, N, nbChannels, sourcefloat);
+    const int steps = context.slicedTransfer(sourcefloat.data(), N, target->planar.data(), M, params, warm ? &target->projections : NULL);
+    
+    if (request.getNumber("regularization", 0) != 0)
+      regularize(sourcefloat, source, width, height, nbChannels,
+                 request.getNumber("sigmaXY", 16.0), request.getNumber("sigmaV", 5.0), regularizer);
+    
+    std::vector<unsigned char> output;
+    toImage(sourcefloat, N, nbChannels, output);
+    stbi_image_free(source);
+    
+    //The result is either written by the server or sent back (PNG)
+    int errcode;
+    if (request.has("output"))
+      errcode = stbi_write_png(request.get("output").c_str(), width, height, nbChannels, output.data(), nbChannels*width);
+    else
+      errcode = stbi_write_png_to_func(appendBytes, &reply.payload, width, height, nbChannels, output.data(), nbChannels*width);
+    if (!errcode)
+    {
+      error = "Error while exporting the resulting image.";
+      return false;
+    }
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    reply.set("width", width);
+    reply.set("height", height);
+    reply.set("seconds", elapsed.count());
+    reply.set("steps", steps);
+    if (!silent)
+    {
+      std::ostringstream msg;
+      msg<<"job "<<width<<"x"<<height<<" -> "<<request.get("target")<<(warm ? "" : " (cold)")<<": "<<1000.0*elapsed.count()<<" ms";
+      log(msg.str());
+    }
+    return true;
   }
-}
+  
+  void log(const std::string &msg)
+  {
+    std::unique_lock<std::mutex> lock(logMutex);
+    std::cout<<msg<<std::endl;
+  }
+  
+  const unsigned int nbDirections;
+  const unsigned int nbQuantiles;
+  const uint64_t seed;
+  const DirectionSequence::Schedule schedule;
+  const std::string regularizer;
+  const unsigned int idleMs;
+  std::map<std::string, std::shared_ptr<const WarmTarget> > targets;
+  std::deque<int> pending;
+  std::set<int> active;
+  bool stopping;
+  std::mutex mutex;
+  std::mutex logMutex;
+  std::condition_variable cond;
+};
+#endif
 
 int main(int argc, char **argv)
 {
+  //The time budget includes the decoding of the images
+  const auto programStart = std::chrono::steady_clock::now();
   CLI::App app{"colorTransfer"};
   std::string sourceImage="pexelAred.png";
   app.add_option("-s,--source", sourceImage, "Source image");
   std::string targetImage="pexelBred.png";
   app.add_option("-t,--target", targetImage, "Target image");
+  std::string targetProjFile;
+  app.add_option("--target-proj", targetProjFile, "Precomputed target projections (see precomputeTarget), used in place of the target image");
   std::string outputImage= "output.png";
   app.add_option("-o,--output", outputImage, "Output image");
   unsigned int nbSteps = 3;
   app.add_option("-n,--nbsteps", nbSteps, "Number of sliced steps (3)");
   unsigned int batchSize = 1;
   app.add_option("-b,--sizeBatch", batchSize, "Number of dirtections on a batch (1)");
+  double tolerance = 0.0;
+  app.add_option("--tol", tolerance, "Stop when the relative improvement of the sliced Wasserstein estimate of a step falls below this tolerance (0 = run nbsteps steps)");
+  unsigned int maxSteps = 100;
+  app.add_option("--max-steps", maxSteps, "Maximal number of steps with --tol or --time-budget-ms, replaces nbsteps (100)");
+  double timeBudget = 0.0;
+  app.add_option("--time-budget-ms", timeBudget, "Run steps until this time budget (milliseconds, from the start of the program, encoding excluded) is spent and export the result so far (0 = no budget)");
+  unsigned int progressive = 0;
+  app.add_option("--progressive", progressive, "Export the intermediate result every K steps as output-<steps>.png (0 = off)");
+  double sampleFraction = 1.0;
+  app.add_option("--sample-fraction", sampleFraction, "Fraction of the pixels sampled by each slice, the 1D map between the samples being interpolated for all pixels (1 = all pixels)");
+  std::string matcher = "sort";
+  app.add_option("--matcher", matcher, "1D matching of the slices: sorts of the projections (exact) or counting sorts on histogram bins and CDF inversion (approximate, O(N)) (sort)")->check(CLI::IsMember({"sort", "histogram"}));
+  size_t histogramBins = TransferParameters::DEFAULT_HISTOGRAM_BINS;
+  app.add_option("--histogram-bins", histogramBins, "Number of bins of the histogram matcher (131072)")->check(CLI::Range((size_t)2, (size_t)1 << 30));
   bool applyRegularization = false;
   app.add_flag("-r,--regularization", applyRegularization, "Apply a regularization step of the transport plan using bilateral filter (false).");
   float sigmaXY = 16.0;
   app.add_option("--sigmaXY", sigmaXY, "Sigma parameter in the spatial domain for the bilateral regularization (16.0)");
   float sigmaV = 5.0;
   app.add_option("--sigmaV", sigmaV, "Sigma parameter in the value domain for the bilateral regularization (5.0)");
+  std::string regularizer = "cimg";
+  app.add_option("--regularizer", regularizer, "Bilateral filter of the regularization: grid (multi-threaded bilateral grid) or cimg (CImg::blur_bilateral) (cimg)")->check(CLI::IsMember({"grid", "cimg"}));
   silent = false;
   app.add_flag("--silent", silent, "No verbose messages");
   double factor = 1.0;
   app.add_option("--factor", factor, "Displacement factor [0:1]");
+  bool uniqueMode = false;
+  app.add_flag("-u,--unique", uniqueMode, "Run the sliced flow on the weighted sets of unique colors (false)");
+  stdSort = false;
+  app.add_flag("--stdsort", stdSort, "Use std::sort instead of the parallel radix sort for the 1D problems (false)");
+  uint64_t seed = 10;
+  app.add_option("--seed", seed, "Seed of the random slice directions, the results do not depend on the number of threads (10)");
+  std::string directions = "gaussian";
+  app.add_option("--directions", directions, "Schedule of the slice directions: independent gaussian directions, random orthonormal bases or low-discrepancy (QMC) sequence (gaussian)")->check(CLI::IsMember({"gaussian", "orthobasis", "qmc"}));
+  unsigned int pyramidLevels = 0;
+  app.add_option("--pyramid-levels", pyramidLevels, "Solve on images downsampled by 2^levels and lift the displacements to full resolution with a color lattice (0 = off)");
+  unsigned int latticeSize = 33;
+  app.add_option("--lattice-size", latticeSize, "Resolution of the color lattice of the pyramid mode (33)");
+  bool pyramidCheck = false;
+  app.add_flag("--pyramid-check", pyramidCheck, "Also run the full resolution solve and report the time and error of the pyramid mode (false)");
+  std::string lutFile;
+  app.add_option("--lut", lutFile, "Export the color mapping as a 3D LUT (.cube file, see applyLut)");
+  unsigned int lutSize = 33;
+  app.add_option("--lut-size", lutSize, "Number of nodes per axis of the exported LUT (33)");
+  unsigned int nbQuantiles = 0;
+  app.add_option("--quantiles", nbQuantiles, "Number of quantile knots of the target projections (0 = all the sorted projections)");
+  unsigned int nbThreads = 0;
+  app.add_option("--threads", nbThreads, "Number of threads of the worker pool (0 = all cores)");
+  std::string profileJson;
+  app.add_option("--profile-json", profileJson, "Export the time spent in each phase (and per slice) to a JSON file");
+  std::string serverSocket;
+  app.add_option("--server", serverSocket, "Run as a daemon serving transfer jobs on this Unix socket (see colorTransferClient)");
+  std::vector<std::string> serverTargets;
+  app.add_option("--register", serverTargets, "Server mode: targets decoded at startup, as id=image (repeatable)");
+  unsigned int serverJobs = 0;
+  app.add_option("--server-jobs", serverJobs, "Server mode: number of jobs processed concurrently (0 = number of threads)");
+  unsigned int serverDirections = 64;
+  app.add_option("--server-directions", serverDirections, "Server mode: number of precomputed projections per target, jobs with more slices project the target on the fly (64)");
+  unsigned int serverIdleMs = 5000;
+  app.add_option("--server-idle-ms", serverIdleMs, "Server mode: a connection without request for this time (milliseconds) is closed, freeing its job thread (5000, 0 = never)");
   CLI11_PARSE(app, argc, argv);
   
-  //Image loading
-  int width,height, nbChannels;
-  unsigned char *source = stbi_load(sourceImage.c_str(), &width, &height, &nbChannels, 0);
-  if (!silent) std::cout<< "Source image: "<<width<<"x"<<height<<"   ("<<nbChannels<<")"<< std::endl;
-  int width_target,height_target, nbChannels_target;
-  unsigned char *target = stbi_load(targetImage.c_str(), &width_target, &height_target, &nbChannels_target, 0);
-  if (!silent) std::cout<< "Target image: "<<width_target<<"x"<<height_target<<"   ("<<nbChannels_target<<")"<< std::endl;
+  ThreadPool::instance().resize(nbThreads);
+  const bool anytime = (tolerance > 0.0) || (timeBudget > 0.0);
+  if (anytime)
+    nbSteps = maxSteps;
+  if ((progressive > 0) && (pyramidLevels > 0))
+  {
+    std::cout<< "The progressive export cannot be used in the pyramid mode."<<std::endl;
+    exit(1);
+  }
+  if ((sampleFraction <= 0.0) || (sampleFraction > 1.0))
+  {
+    std::cout<< "The sample fraction must be in (0, 1]."<<std::endl;
+    exit(1);
+  }
+  if (uniqueMode && (sampleFraction < 1.0))
+  {
+    std::cout<< "The sampled slices cannot be used in the unique color mode."<<std::endl;
+    exit(1);
+  }
+  if ((matcher == "histogram") && (uniqueMode || (sampleFraction < 1.0)))
+  {
+    std::cout<< "The histogram matcher cannot be used with the unique colors or the sampled slices."<<std::endl;
+    exit(1);
+  }
   
-  if ((width*height) != (width_target*height_target))
+  if (!serverSocket.empty())
   {
-    std::cout<< "Image sizes do not match. "<<std::endl;
+#ifdef _WIN32
+    std::cout<< "The server mode is not available on this platform."<<std::endl;
     exit(1);
+#else
+    TransferServer server(serverDirections, nbQuantiles, seed, DirectionSequence::scheduleFromName(directions), regularizer, serverIdleMs);
+    for(auto &target : serverTargets)
+    {
+      const size_t eq = target.find('=');
+      std::string error = "(expected id=image)";
+      if ((eq == std::string::npos) || !server.registerTarget(target.substr(0, eq), target.substr(eq+1), error))
+      {
+        std::cout<< "Cannot register the target "<<target<<": "<<error<<std::endl;
+        exit(1);
+      }
+      if (!silent) std::cout<< "Registered target "<<target<< std::endl;
+    }
+    server.run(serverSocket, serverJobs ? serverJobs : ThreadPool::instance().size());
+    exit(0);
+#endif
+  }
+  Profiler::instance().enable(!profileJson.empty());
+  
+  //Image loading
+  int width,height, nbChannels;
+  unsigned char *source = NULL;
+  {
+    Profiler::Scope scope("decode");
+    source = stbi_load(sourceImage.c_str(), &width, &height, &nbChannels, 0);
   }
+  if (!silent) std::cout<< "Source image: "<<width<<"x"<<height<<"   ("<<nbChannels<<")"<< std::endl;
+  if (!silent) std::cout<< "SIMD kernels: "<<simdKernels().name<< std::endl;
   if (nbChannels <3)
   {
     std::cout<< "Input images must be color images."<<std::endl;
     exit(1);
   }
   
-  std::vector<float> sourcefloat(width*height*nbChannels);
-  std::vector<float> targetfloat(width*height*nbChannels);
-  for(auto i = 0 ; i <width*height*nbChannels; ++i)
+  int width_target=0,height_target=0, nbChannels_target=0;
+  unsigned char *target = NULL;
+  TargetProjections targetProj;
+  const bool precomputed = !targetProjFile.empty();
+  if (precomputed)
+  {
+    //Precomputed target: directions and sorted projections
+    if (!targetProj.load(targetProjFile))
+    {
+      std::cout<< "Error while loading the target projections."<<std::endl;
+      exit(1);
+    }
+    if (!silent) std::cout<< "Target projections: "<<targetProj.nbDirections<<" directions, "<<targetProj.nbProjections<<" projections"<< std::endl;
+    if (uniqueMode)
+    {
+      std::cout<< "Precomputed target projections cannot be used in the unique color mode."<<std::endl;
+      exit(1);
+    }
+    //With a stopping criterion, the number of steps is bounded by the file
+    if (anytime)
+      nbSteps = std::max(1u, std::min(nbSteps, targetProj.nbDirections/batchSize));
+    if ((targetProj.dim != 3) || (targetProj.nbDirections < nbSteps*batchSize))
+    {
+      std::cout<< "The target projection file holds "<<targetProj.nbDirections<<" directions, "<<nbSteps*batchSize<<" are required."<<std::endl;
+      exit(1);
+    }
+    if (app.count("--seed") && (seed != targetProj.seed))
+    {
+      std::cout<< "The target projection file was computed with the seed "<<targetProj.seed<<"."<<std::endl;
+      exit(1);
+    }
+    if (app.count("--directions") && ((uint32_t)DirectionSequence::scheduleFromName(directions) != targetProj.schedule))
+    {
+      std::cout<< "The target projection file was computed with the "<<DirectionSequence::scheduleName((DirectionSequence::Schedule)targetProj.schedule)<<" directions."<<std::endl;
+      exit(1);
+    }
+    directions = DirectionSequence::scheduleName((DirectionSequence::Schedule)targetProj.schedule);
+  }
+  else
+  {
+    Profiler::Scope scope("decode");
+    target = stbi_load(targetImage.c_str(), &width_target, &height_target, &nbChannels_target, 0);
+    if (!silent) std::cout<< "Target image: "<<width_target<<"x"<<height_target<<"   ("<<nbChannels_target<<")"<< std::endl;
+    
+    if (nbChannels_target <3)
+    {
+      std::cout<< "Input images must be color images."<<std::endl;
+      exit(1);
+    }
+  }
+  
+  //Planar float buffers (one array per channel), only the first three
+  //channels are transferred (alpha is kept)
+  const int N = width*height;
+  std::vector<float> sourcefloat;
+  std::vector<float> targetfloat;
+  const int M = width_target*height_target;
   {
-    sourcefloat[i] = static_cast<float>(source[i]);
-    targetfloat[i] = static_cast<float>(target[i]);
+    Profiler::Scope scope("convert");
+    toPlanar(source, N, nbChannels, sourcefloat);
+    if ((!uniqueMode) && (!precomputed))
+      toPlanar(target, M, nbChannels_target, targetfloat);
+  }
+  
+  if (uniqueMode && (pyramidLevels > 0))
+  {
+    std::cout<< "The pyramid mode cannot be used in the unique color mode."<<std::endl;
+    exit(1);
   }
   
   //Main computation
+  TransferContext context;
+  TransferParameters params;
+  params.nbSteps = nbSteps;
+  params.batchSize = batchSize;
+  params.factor = factor;
+  params.nbQuantiles = nbQuantiles;
+  params.seed = seed;
+  params.directions = DirectionSequence::scheduleFromName(directions);
+  params.tolerance = tolerance;
+  params.useStdSort = stdSort;
+  params.verbose = !silent;
+  if (timeBudget > 0.0)
+  {
+    //Remaining budget, at least one step is performed
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - programStart;
+    params.timeBudget = std::max(1e-6, timeBudget/1000.0 - spent.count());
+  }
+  params.progressSteps = progressive;
+  params.sampleFraction = sampleFraction;
+  params.useHistogram = (matcher == "histogram");
+  params.histogramBins = histogramBins;
+  //Progressive export of a planar result, with the same post-processing as the final output
+  auto exportProgress = [&](std::vector<float> result, const int k) {
+    Profiler::Scope scope("progressive");
+    if (applyRegularization)
+      regularize(result, source, width, height, nbChannels, sigmaXY, sigmaV, regularizer);
+    std::vector<unsigned char> image;
+    toImage(result, N, nbChannels, image);
+    //Written under a temporary name first, so that a reader never sees a partial file
+    const std::string name = progressiveName(outputImage, k);
+    const std::string partial = name + ".part";
+    if (!stbi_write_png(partial.c_str(), width, height, nbChannels, image.data(), nbChannels*width) ||
+        std::rename(partial.c_str(), name.c_str()))
+    {
+      std::cout<<"Error while exporting the intermediate image "<<name<<"."<<std::endl;
+      exit(1);
+    }
+    if (!silent) std::cout<<"Intermediate result: "<<name<<std::endl;
+  };
   auto start = std::chrono::system_clock::now();
+  int steps = 0;
   
-  slicedTransfer(sourcefloat, targetfloat, nbSteps, batchSize, factor);
+  if (uniqueMode)
+  {
+    //Compression to the weighted sets of unique colors
+    std::vector<float> sourceColors, sourceWeights, targetColors, targetWeights;
+    std::vector<unsigned int> sourceIndex, targetIndex;
+    uniqueColors(source, N, nbChannels, sourceColors, sourceWeights, sourceIndex);
+    uniqueColors(target, width_target*height_target, nbChannels_target, targetColors, targetWeights, targetIndex);
+    if (!silent) std::cout<< "Unique colors: "<<sourceWeights.size()<<" (source) "<<targetWeights.size()<<" (target)"<< std::endl;
+    
+    const size_t K = sourceWeights.size();
+    const size_t L = targetWeights.size();
+    float *sourceChannels[3] = {&sourceColors[0], &sourceColors[K], &sourceColors[2*K]};
+    const float *targetChannels[3] = {&targetColors[0], &targetColors[L], &targetColors[2*L]};
+    params.progress = [&](int k) {
+      std::vector<float> result(sourcefloat);
+      for(auto c = 0; c < 3; ++c)
+        for(auto i = 0 ; i < N; ++i)
+          result[c*N+i] = sourceColors[c*K + sourceIndex[i]];
+      exportProgress(result, k);
+    };
+    steps = context.slicedTransferWeighted(sourceChannels, sourceWeights.data(), K, targetChannels, targetWeights.data(), L, params);
+    params.progress = nullptr;
+    
+    //Scatter back the advected colors to the pixels
+    for(auto k = 0; k < 3; ++k)
+      for(auto i = 0 ; i < N; ++i)
+        sourcefloat[k*N+i] = sourceColors[k*K + sourceIndex[i]];
+  }
+  else if (pyramidLevels > 0)
+    steps = pyramidTransfer(sourcefloat, width, height, targetfloat, width_target, height_target, pyramidLevels, latticeSize,
+                            context, params, precomputed ? &targetProj : NULL);
+  else
+  {
+    params.progress = [&](int k) { exportProgress(sourcefloat, k); };
+    steps = context.slicedTransfer(sourcefloat.data(), N, targetfloat.data(), M, params, precomputed ? &targetProj : NULL);
+  }
+  //No estimate without steps (-n 0)
+  const std::vector<double> distances = context.distances();
   
   auto end = std::chrono::system_clock::now();
   std::chrono::duration<double> elapsed_seconds = end - start;
   std::time_t end_time = std::chrono::system_clock::to_time_t(end);
   std::cout << "finished computation at " << std::ctime(&end_time)
   << "elapsed time: " << elapsed_seconds.count() << "s\n";
+  if (!silent && !distances.empty()) std::cout << "steps: " << steps << "/" << nbSteps << ", sliced Wasserstein estimate: " << distances.back() << std::endl;
+  
+  if ((pyramidLevels > 0) && pyramidCheck)
+  {
+    //Full resolution solve, for comparison
+    std::vector<float> full;
+    toPlanar(source, N, nbChannels, full);
+    auto startFull = std::chrono::system_clock::now();
+    context.slicedTransfer(full.data(), N, targetfloat.data(), M, params, precomputed ? &targetProj : NULL);
+    std::chrono::duration<double> fullSeconds = std::chrono::system_clock::now() - startFull;
+    
+    //Error on the clamped 8-bit values
+    double mae = 0.0, rmse = 0.0, maxErr = 0.0;
+    for(auto i = 0; i < 3*N; ++i)
+    {
+      double a = std::min(255.0f, std::max(0.0f, sourcefloat[i]));
+      double b = std::min(255.0f, std::max(0.0f, full[i]));
+      mae += std::abs(a - b);
+      rmse += (a - b)*(a - b);
+      maxErr = std::max(maxErr, std::abs(a - b));
+    }
+    mae /= 3.0*N;
+    rmse = std::sqrt(rmse/(3.0*N));
+    std::cout << "full solve time: " << fullSeconds.count() << "s (x" << fullSeconds.count()/elapsed_seconds.count() << ")\n"
+    << "pyramid vs full solve: MAE " << mae << " RMSE " << rmse << " max " << maxErr << "\n";
+  }
 
   //Output
-  std::vector<unsigned char> output(width*height*nbChannels);
+  std::vector<unsigned char> output;
   if (applyRegularization)
   {
     //Regularization of the transport plan (optional)
     // (bilateral filter of the difference)
     if (!silent) std::cout<<"Applying regularization step"<<std::endl;
-    cimg_library::CImg<float> transport(width, height, 1, 3);
-    for(auto i=0; i<width*height; ++i)
+    Profiler::Scope scope("regularization");
+    regularize(sourcefloat, source, width, height, nbChannels, sigmaXY, sigmaV, regularizer);
+  }
+  toImage(sourcefloat, N, nbChannels, output);
+  
+  if (!lutFile.empty())
+  {
+    //3D LUT of the source -> output color mapping
+    Profiler::Scope scope("lut");
+    std::vector<float> original, disp(3*N);
+    toPlanar(source, N, nbChannels, original);
+    for(auto k = 0; k < 3; ++k)
+      for(auto i = 0; i < N; ++i)
+        disp[k*N+i] = static_cast<float>(output[nbChannels*i+k]) - original[k*N+i];
+    const float *colorChannels[3] = {&original[0], &original[N], &original[2*N]};
+    const float *dispChannels[3] = {&disp[0], &disp[N], &disp[2*N]};
+    ColorLattice lattice(lutSize);
+    lattice.fit(colorChannels, dispChannels, N);
+    CubeLut lut;
+    lut.fromLattice(lattice);
+    if (!lut.save(lutFile))
     {
-      transport[i] = sourcefloat[3*i] - static_cast<float>(source[3*i]);
-      transport[i+ width*height] = sourcefloat[3*i+1] - static_cast<float>(source[3*i+1]);
-      transport[i+2*width*height] = sourcefloat[3*i+2] - static_cast<float>(source[3*i+2]);
+      std::cout<<"Error while exporting the LUT."<<std::endl;
+      exit(1);
     }
-    transport.blur_bilateral(transport, sigmaXY,sigmaV);
-    
-    auto output2(output);
-    for(auto i = 0 ; i < width*height ; ++i)
+    if (!silent)
     {
-      output[3*i]   = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i  ]) + transport[i])));
-      output[3*i+1] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+1]) + transport[i+ width*height])));
-      output[3*i+2] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+2]) + transport[i+ width*height*2])));
+      std::vector<unsigned char> graded(N*nbChannels);
+      lut.apply(source, graded.data(), N, nbChannels);
+      double mae = 0.0;
+      for(auto i = 0; i < N; ++i)
+        for(auto k = 0; k < 3; ++k)
+          mae += std::abs((int)graded[nbChannels*i+k] - (int)output[nbChannels*i+k]);
+      std::cout<<"LUT "<<lut.size<<"^3 exported, mean absolute error vs the output: "<<mae/(3.0*N)<<std::endl;
     }
   }
-  else
-  {
-    for(auto i = 0 ; i < width*height*nbChannels ; ++i)
-      output[i] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f,  sourcefloat[i])));
-  }
   
   //Final export
   if (!silent) std::cout<<"Exporting.."<<std::endl;
-  int errcode = stbi_write_png(outputImage.c_str(), width, height, nbChannels, output.data(), nbChannels*width);
+  int errcode = 0;
+  {
+    Profiler::Scope scope("encode");
+    errcode = stbi_write_png(outputImage.c_str(), width, height, nbChannels, output.data(), nbChannels*width);
+  }
   if (!errcode)
   {
     std::cout<<"Error while exporting the resulting image."<<std::endl;
     exit(errcode);
   }
   
+  if (!profileJson.empty())
+  {
+    Profiler &profiler = Profiler::instance();
+    profiler.setInfo("tool", "colorTransfer");
+    profiler.setInfo("source", sourceImage);
+    profiler.setInfo("target", precomputed ? targetProjFile : targetImage);
+    profiler.setInfo("pixels", N);
+    profiler.setInfo("nbsteps", nbSteps);
+    profiler.setInfo("batch", batchSize);
+    profiler.setInfo("steps", steps);
+    profiler.setInfo("budget", timeBudget);
+    profiler.setInfo("sample", sampleFraction);
+    profiler.setInfo("matcher", matcher);
+    profiler.setInfo("threads", ThreadPool::instance().size());
+    profiler.setInfo("simd", simdKernels().name);
+    profiler.setInfo("sort", stdSort ? "std" : "radix");
+    profiler.setInfo("directions", directions);
+    if (!profiler.saveJson(profileJson))
+    {
+      std::cout<<"Error while exporting the profile."<<std::endl;
+      exit(1);
+    }
+  }
+  
   stbi_image_free(source);
   stbi_image_free(target);
   exit(0);
@@ -0,0 +1,220 @@
+/*
+ Copyright (c) 2019 CNRS
+ David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+ 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+//Command-line parsing
+#include "CLI11.hpp"
+
+#include "UnbalancedSliced/JobProtocol.h"
+
+//Client of the colorTransfer server (colorTransfer --server): sends transfer
+//jobs, or registers targets, on the server Unix socket.
+
+//Paths are resolved on the client side since the server may run elsewhere
+std::string absolutePath(const std::string &path)
+{
+  if (path.empty() || path[0] == '/')
+    return path;
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return path;
+  return std::string(cwd) + "/" + path;
+}
+
+int main(int argc, char **argv)
+{
+  CLI::App app{"colorTransferClient"};
+  std::string socketPath;
+  app.add_option("-S,--socket", socketPath, "Unix socket of the server")->required();
+  std::string sourceImage;
+  app.add_option("-s,--source", sourceImage, "Source image");
+  bool sendSource = false;
+  app.add_flag("--send", sendSource, "Send the content of the source image instead of its path (false)");
+  std::string targetId;
+  app.add_option("-t,--target", targetId, "Id of a target registered on the server");
+  std::string outputImage = "output.png";
+  app.add_option("-o,--output", outputImage, "Output image");
+  bool remoteOutput = false;
+  app.add_flag("--remote-output", remoteOutput, "Let the server write the output image instead of sending it back (false)");
+  unsigned int nbSteps = 3;
+  app.add_option("-n,--nbsteps", nbSteps, "Number of sliced steps (3)");
+  unsigned int batchSize = 1;
+  app.add_option("-b,--sizeBatch", batchSize, "Number of dirtections on a batch (1)");
+  double tolerance = 0.0;
+  app.add_option("--tol", tolerance, "Stop when the relative improvement of the sliced Wasserstein estimate of a step falls below this tolerance (0 = run nbsteps steps)");
+  unsigned int maxSteps = 100;
+  app.add_option("--max-steps", maxSteps, "Maximal number of steps with --tol or --time-budget-ms, replaces nbsteps (100)");
+  double timeBudget = 0.0;
+  app.add_option("--time-budget-ms", timeBudget, "Run steps until this time budget (milliseconds, from the reception of the job by the server) is spent (0 = no budget)");
+  double sampleFraction = 1.0;
+  app.add_option("--sample-fraction", sampleFraction, "Fraction of the pixels sampled by each slice, the 1D map between the samples being interpolated for all pixels (1 = all pixels)");
+  std::string matcher = "sort";
+  app.add_option("--matcher", matcher, "1D matching of the slices: sorts of the projections (exact) or counting sorts on histogram bins and CDF inversion (approximate, O(N)) (sort)")->check(CLI::IsMember({"sort", "histogram"}));
+  bool applyRegularization = false;
+  app.add_flag("-r,--regularization", applyRegularization, "Apply a regularization step of the transport plan using bilateral filter (false).");
+  float sigmaXY = 16.0;
+  app.add_option("--sigmaXY", sigmaXY, "Sigma parameter in the spatial domain for the bilateral regularization (16.0)");
+  float sigmaV = 5.0;
+  app.add_option("--sigmaV", sigmaV, "Sigma parameter in the value domain for the bilateral regularization (5.0)");
+  double factor = 1.0;
+  app.add_option("--factor", factor, "Displacement factor [0:1]");
+  uint64_t seed = 10;
+  app.add_option("--seed", seed, "Seed of the random slice directions, the precomputed projections of the server are only used for its own seed (10)");
+  std::string directions = "gaussian";
+  app.add_option("--directions", directions, "Schedule of the slice directions: gaussian, orthobasis or qmc, the precomputed projections of the server are only used for its own schedule (gaussian)")->check(CLI::IsMember({"gaussian", "orthobasis", "qmc"}));
+  unsigned int repeat = 1;
+  app.add_option("--repeat", repeat, "Number of times the job is sent on the same connection (1)");
+  std::string registration;
+  app.add_option("--register", registration, "Register a target on the server, as id=image, instead of sending a job");
+  bool listTargets = false;
+  app.add_flag("--targets", listTargets, "List the targets registered on the server");
+  bool silent = false;
+  app.add_flag("--silent", silent, "No verbose messages");
+  CLI11_PARSE(app, argc, argv);
+  
+  const int fd = connectUnixSocket(socketPath);
+  if (fd < 0)
+  {
+    std::cout<< "Cannot connect to "<<socketPath<<std::endl;
+    exit(1);
+  }
+  JobChannel channel(fd);
+  JobMessage request, reply;
+  
+  if (!registration.empty() || listTargets)
+  {
+    if (listTargets)
+      request.set("cmd", "targets");
+    else
+    {
+      const size_t eq = registration.find('=');
+      if (eq == std::string::npos)
+      {
+        std::cout<< "Targets are registered as id=image."<<std::endl;
+        exit(1);
+      }
+      request.set("cmd", "register");
+      request.set("id", registration.substr(0, eq));
+      request.set("path", absolutePath(registration.substr(eq+1)));
+    }
+    if (!channel.write(request) || !channel.read(reply))
+    {
+      std::cout<< "Connection lost."<<std::endl;
+      exit(1);
+    }
+    if (reply.get("status") != "ok")
+    {
+      std::cout<< "Error: "<<reply.get("message")<<std::endl;
+      exit(1);
+    }
+    if (listTargets)
+      std::cout<< reply.get("targets")<<std::endl;
+    close(fd);
+    exit(0);
+  }
+  
+  if (sourceImage.empty() || targetId.empty())
+  {
+    std::cout<< "A source image and a target id are required."<<std::endl;
+    exit(1);
+  }
+  request.set("cmd", "transfer");
+  request.set("target", targetId);
+  request.set("nbsteps", nbSteps);
+  if (tolerance > 0.0)
+    request.set("tol", tolerance);
+  if (timeBudget > 0.0)
+    request.set("budgetms", timeBudget);
+  if ((tolerance > 0.0) || (timeBudget > 0.0))
+    request.set("maxsteps", maxSteps);
+  if (sampleFraction < 1.0)
+    request.set("sample", sampleFraction);
+  if (matcher != "sort")
+    request.set("matcher", matcher);
+  request.set("batch", batchSize);
+  request.set("factor", factor);
+  if (app.count("--seed"))
+    request.set("seed", std::to_string(seed));
+  if (app.count("--directions"))
+    request.set("directions", directions);
+  request.set("regularization", applyRegularization ? 1 : 0);
+  request.set("sigmaXY", sigmaXY);
+  request.set("sigmaV", sigmaV);
+  if (remoteOutput)
+    request.set("output", absolutePath(outputImage));
+  if (sendSource)
+  {
+    std::ifstream ifs(sourceImage, std::ifstream::binary);
+    if (!ifs)
+    {
+      std::cout<< "Cannot read "<<sourceImage<<std::endl;
+      exit(1);
+    }
+    request.payload.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  }
+  else
+    request.set("source", absolutePath(sourceImage));
+  
+  for(auto r = 0u; r < repeat; ++r)
+  {
+    auto start = std::chrono::steady_clock::now();
+    if (!channel.write(request) || !channel.read(reply))
+    {
+      std::cout<< "Connection lost."<<std::endl;
+      exit(1);
+    }
+    std::chrono::duration<double> latency = std::chrono::steady_clock::now() - start;
+    if (reply.get("status") != "ok")
+    {
+      std::cout<< "Error: "<<reply.get("message")<<std::endl;
+      exit(1);
+    }
+    if (!remoteOutput)
+    {
+      std::ofstream ofs(outputImage, std::ofstream::binary);
+      ofs.write((const char*)reply.payload.data(), reply.payload.size());
+      if (!ofs)
+      {
+        std::cout<< "Error while exporting the resulting image."<<std::endl;
+        exit(1);
+      }
+    }
+    if (!silent)
+      std::cout<< "job "<<r<<": "<<reply.get("width")<<"x"<<reply.get("height")
+               << " server_ms="<<1000.0*reply.getNumber("seconds", 0.0)
+               << " latency_ms="<<1000.0*latency.count()<<" steps="<<reply.get("steps")<<std::endl;
+  }
+  close(fd);
+  exit(0);
+}
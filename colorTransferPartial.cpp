@@ -31,6 +31,8 @@
 #include <vector>
 #include <chrono>
 #include <ctime>
+#include <cstdio>
+#include <functional>
 
 //Command-line parsing
 #include "CLI11.hpp"
@@ -43,14 +45,36 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-#include "UnbalancedSliced/UnbalancedSliced.h"
+#include "UnbalancedSliced/TransferContext.h"
+#include "UnbalancedSliced/ColorLattice.h"
+#include "UnbalancedSliced/BilateralGrid.h"
+#include "UnbalancedSliced/Profiler.h"
 
 //Global flag to silent verbose messages
 bool silent;
+//Global flag to use std::sort instead of the radix sort
+bool stdSort;
+//Global flag to use the approximate histogram matcher
+bool histogramMatcher;
+//Global seed of the random slice directions
+uint64_t seed;
+//Global schedule of the slice directions
+DirectionSequence::Schedule schedule;
+//Global convergence tolerance (0 = fixed number of steps)
+double tolerance;
+//Global time budget in seconds, counted from programStart (0 = no budget)
+double timeBudget;
+std::chrono::steady_clock::time_point programStart;
+
+//Partial sliced transfer of an interleaved RGB source into the target. With
+//progressSteps > 0, progress(result, k) is called every progressSteps steps with
+//the intermediate (interleaved) result after k steps.
 
 void slicedTransfer(std::vector<float> &source,
                     const std::vector<float> &target,
-                    const int nbSteps)
+                    const int nbSteps,
+                    const int progressSteps = 0,
+                    const std::function<void(const std::vector<float> &, int)> &progress = nullptr)
 {
   omp_set_nested(0);
   
@@ -72,17 +96,43 @@ void slicedTransfer(std::vector<float> &source,
   }
   
   //Main computation
-  UnbalancedSliced sliced;
+  TransferContext context;
+  TransferParameters params;
+  params.nbSteps = nbSteps;
+  params.seed = seed;
+  params.directions = schedule;
+  params.tolerance = tolerance;
+  params.useStdSort = stdSort;
+  params.useHistogram = histogramMatcher;
+  //The sliced Wasserstein estimate is only printed in verbose mode
+  params.computeDistances = !silent;
+  if (timeBudget > 0.0)
+  {
+    //Remaining budget, at least one step is performed
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - programStart;
+    params.timeBudget = std::max(1e-6, timeBudget - spent.count());
+  }
+  params.progressSteps = progressSteps;
+  if (progress)
+    params.progress = [&](int k) {
+      std::vector<float> result(source);
+      for (int i = 0; i < N; i++)
+        for (int j = 0; j < 3; j++)
+          result[i * 3 + j] = points[0][i][j];
+      progress(result, k);
+    };
 
   auto start = std::chrono::system_clock::now();
   
-  sliced.correspondencesNd<3, float>(points[0], points[1], nbSteps, true);
+  context.correspondencesNd<3, float>(points[0], points[1], params, true);
   
   auto end = std::chrono::system_clock::now();
   std::chrono::duration<double> elapsed_seconds = end - start;
   std::time_t end_time = std::chrono::system_clock::to_time_t(end);
   std::cout << "finished computation at " << std::ctime(&end_time)
             << "elapsed time: " << elapsed_seconds.count() << "s\n";
+  const std::vector<double> &distances = context.unbalanced().distances();
+  if (!silent && !distances.empty()) std::cout << "steps: " << distances.size() << "/" << nbSteps << ", sliced Wasserstein estimate: " << distances.back() << std::endl;
   
   //Copyback
   for (int i = 0; i < N; i++)
@@ -93,8 +143,153 @@ void slicedTransfer(std::vector<float> &source,
   }
 }
 
+//Downsamples an interleaved 8-bit image by 2^levels in each direction
+//(moving average) and returns its interleaved RGB values
+std::vector<float> downsample(const unsigned char *image,
+                              const int width,
+                              const int height,
+                              const int nbChannels,
+                              const int levels,
+                              int &coarseWidth,
+                              int &coarseHeight)
+{
+  coarseWidth  = std::max(1, width >> levels);
+  coarseHeight = std::max(1, height >> levels);
+  cimg_library::CImg<float> img(width, height, 1, 3);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < width*height; ++i)
+      img[k*width*height + i] = static_cast<float>(image[nbChannels*i + k]);
+  img.resize(coarseWidth, coarseHeight, 1, 3, 2);
+  const int Nc = coarseWidth*coarseHeight;
+  std::vector<float> coarse(3*Nc);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < Nc; ++i)
+      coarse[3*i + k] = img[k*Nc + i];
+  return coarse;
+}
+
+//Coarse-to-fine transfer: the partial sliced transport is computed on images
+//downsampled by 2^levels, and the coarse displacements are lifted to the full
+//resolution source (interleaved RGB) by a 3D color lattice.
+void pyramidTransfer(std::vector<float> &sourcefloat,
+                     const unsigned char *source,
+                     const int width,
+                     const int height,
+                     const int nbChannels,
+                     const unsigned char *target,
+                     const int widthTarget,
+                     const int heightTarget,
+                     const int nbChannelsTarget,
+                     const int levels,
+                     const int latticeSize,
+                     const int nbSteps)
+{
+  int cw, ch, cwt, cht;
+  std::vector<float> coarse, coarseTarget;
+  {
+    Profiler::Scope scope("downsampling");
+    coarse = downsample(source, width, height, nbChannels, levels, cw, ch);
+    coarseTarget = downsample(target, widthTarget, heightTarget, nbChannelsTarget, levels, cwt, cht);
+  }
+  if (!silent) std::cout<<"Pyramid level "<<levels<<": "<<cw<<"x"<<ch<<" (source) "<<cwt<<"x"<<cht<<" (target)"<<std::endl;
+  if (cw*ch > cwt*cht)
+  {
+    std::cout<< "The source image must be smaller (or equal to) than the target image. "<<std::endl;
+    exit(1);
+  }
+  
+  std::vector<float> transported(coarse);
+  slicedTransfer(transported, coarseTarget, nbSteps);
+  
+  //Coarse displacements (planar), lifted by the color lattice
+  Profiler::Scope scope("lattice");
+  const size_t Nc = cw*ch;
+  std::vector<float> coarsePlanar(3*Nc), dispPlanar(3*Nc);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < Nc; ++i)
+    {
+      coarsePlanar[k*Nc + i] = coarse[3*i + k];
+      dispPlanar[k*Nc + i] = transported[3*i + k] - coarse[3*i + k];
+    }
+  const float *coarseChannels[3] = {&coarsePlanar[0], &coarsePlanar[Nc], &coarsePlanar[2*Nc]};
+  const float *dispChannels[3] = {&dispPlanar[0], &dispPlanar[Nc], &dispPlanar[2*Nc]};
+  ColorLattice lattice(latticeSize);
+  lattice.fit(coarseChannels, dispChannels, Nc);
+  
+  const size_t N = width*height;
+  std::vector<float> planar(3*N);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < N; ++i)
+      planar[k*N + i] = sourcefloat[3*i + k];
+  float *channels[3] = {&planar[0], &planar[N], &planar[2*N]};
+  lattice.apply(channels, N);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < N; ++i)
+      sourcefloat[3*i + k] = planar[k*N + i];
+}
+
+//Name of the intermediate image of a progressive transfer after the given number of
+//steps: the step count is inserted before the extension (output-0010.png)
+std::string progressiveName(const std::string &output, const int steps)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%04d", steps);
+  const size_t dot = output.find_last_of('.');
+  const size_t slash = output.find_last_of("/\\");
+  if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+    return output + suffix;
+  return output.substr(0, dot) + suffix + output.substr(dot);
+}
+
+//Converts the interleaved RGB result of the transfer to an 8-bit image, with the
+//optional regularization of the transport plan
+void toImage(const std::vector<float> &sourcefloat,
+             const unsigned char *source,
+             const int width,
+             const int height,
+             const int nbChannels,
+             const bool applyRegularization,
+             const float sigmaXY,
+             const float sigmaV,
+             const std::string &regularizer,
+             std::vector<unsigned char> &output)
+{
+  output.resize(width*height*nbChannels);
+  if (applyRegularization)
+  {
+    //Regularization of the transport plan (optional)
+    // (bilateral filter of the difference)
+    Profiler::Scope scope("regularization");
+    cimg_library::CImg<float> transport(width, height, 1, 3);
+    for(auto i=0; i<width*height; ++i)
+    {
+      transport[i] = sourcefloat[3*i] - static_cast<float>(source[3*i]);
+      transport[i+ width*height] = sourcefloat[3*i+1] - static_cast<float>(source[3*i+1]);
+      transport[i+2*width*height] = sourcefloat[3*i+2] - static_cast<float>(source[3*i+2]);
+    }
+    if (regularizer == "cimg")
+      transport.blur_bilateral(transport, sigmaXY,sigmaV);
+    else
+      BilateralGrid::filterPlanar(transport.data(), width, height, 3, sigmaXY, sigmaV);
+  
+    for(auto i = 0 ; i < width*height ; ++i)
+    {
+      output[3*i]   = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i  ]) + transport[i])));
+      output[3*i+1] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+1]) + transport[i+ width*height])));
+      output[3*i+2] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+2]) + transport[i+ width*height*2])));
+    }
+  }
+  else
+  {
+    for(auto i = 0 ; i < width*height*nbChannels ; ++i)
+      output[i] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f,  sourcefloat[i])));
+  }
+}
+
 int main(int argc, char **argv)
 {
+  //The time budget includes the decoding of the images
+  programStart = std::chrono::steady_clock::now();
   CLI::App app{"colorTransfer"};
   std::string sourceImage="pexelAred.png";
   app.add_option("-s,--source", sourceImage, "Source image");
@@ -104,23 +299,70 @@ int main(int argc, char **argv)
   app.add_option("-o,--output", outputImage, "Output image");
   unsigned int nbSteps = 3;
   app.add_option("-n,--nbsteps", nbSteps, "Number of sliced steps (3)");
+  tolerance = 0.0;
+  app.add_option("--tol", tolerance, "Stop when the relative improvement of the sliced Wasserstein estimate falls below this tolerance (0 = run nbsteps steps)");
+  unsigned int maxSteps = 1000;
+  app.add_option("--max-steps", maxSteps, "Maximal number of steps with --tol or --time-budget-ms, replaces nbsteps (1000)");
+  timeBudget = 0.0;
+  app.add_option("--time-budget-ms", timeBudget, "Run steps until this time budget (milliseconds, from the start of the program, encoding excluded) is spent and export the result so far (0 = no budget)");
+  unsigned int progressive = 0;
+  app.add_option("--progressive", progressive, "Export the intermediate result every K steps as output-<steps>.png (0 = off)");
   bool applyRegularization = false;
   app.add_flag("-r,--regularization", applyRegularization, "Apply a regularization step of the transport plan using bilateral filter (false).");
   float sigmaXY = 16.0;
   app.add_option("--sigmaXY", sigmaXY, "Sigma parameter in the spatial domain for the bilateral regularization (16.0)");
   float sigmaV = 5.0;
   app.add_option("--sigmaV", sigmaV, "Sigma parameter in the value domain for the bilateral regularization (5.0)");
+  std::string regularizer = "cimg";
+  app.add_option("--regularizer", regularizer, "Bilateral filter of the regularization: grid (multi-threaded bilateral grid) or cimg (CImg::blur_bilateral) (cimg)")->check(CLI::IsMember({"grid", "cimg"}));
   silent = false;
   app.add_flag("--silent", silent, "No verbose messages");
+  stdSort = false;
+  app.add_flag("--stdsort", stdSort, "Use std::sort instead of the parallel radix sort for the 1D problems (false)");
+  std::string matcher = "sort";
+  app.add_option("--matcher", matcher, "1D matching of the slices: sorts and partial transport (exact) or counting sorts on histogram bins and nearest neighbors (approximate, O(N)) (sort)")->check(CLI::IsMember({"sort", "histogram"}));
+  seed = 10;
+  app.add_option("--seed", seed, "Seed of the random slice directions, the results do not depend on the number of threads (10)");
+  std::string directions = "gaussian";
+  app.add_option("--directions", directions, "Schedule of the slice directions: independent gaussian directions, random orthonormal bases or low-discrepancy (QMC) sequence (gaussian)")->check(CLI::IsMember({"gaussian", "orthobasis", "qmc"}));
+  unsigned int pyramidLevels = 0;
+  app.add_option("--pyramid-levels", pyramidLevels, "Solve on images downsampled by 2^levels and lift the displacements to full resolution with a color lattice (0 = off)");
+  unsigned int latticeSize = 33;
+  app.add_option("--lattice-size", latticeSize, "Resolution of the color lattice of the pyramid mode (33)");
+  bool pyramidCheck = false;
+  app.add_flag("--pyramid-check", pyramidCheck, "Also run the full resolution solve and report the time and error of the pyramid mode (false)");
+  unsigned int nbThreads = 0;
+  app.add_option("--threads", nbThreads, "Number of threads of the worker pool (0 = all cores)");
+  std::string profileJson;
+  app.add_option("--profile-json", profileJson, "Export the time spent in each phase (and per slice) to a JSON file");
   CLI11_PARSE(app, argc, argv);
+  schedule = DirectionSequence::scheduleFromName(directions);
+  histogramMatcher = (matcher == "histogram");
+  
+  ThreadPool::instance().resize(nbThreads);
+  timeBudget /= 1000.0;
+  if ((tolerance > 0.0) || (timeBudget > 0.0))
+    nbSteps = maxSteps;
+  if ((progressive > 0) && (pyramidLevels > 0))
+  {
+    std::cout<< "The progressive export cannot be used in the pyramid mode."<<std::endl;
+    exit(1);
+  }
+  omp_set_num_threads(ThreadPool::instance().size());
+  Profiler::instance().enable(!profileJson.empty());
   
   //Image loading
   int width,height, nbChannels;
-  unsigned char *source = stbi_load(sourceImage.c_str(), &width, &height, &nbChannels, 0);
-  if (!silent) std::cout<< "Source image: "<<width<<"x"<<height<<"   ("<<nbChannels<<")"<< std::endl;
   int width_target,height_target, nbChannels_target;
-  unsigned char *target = stbi_load(targetImage.c_str(), &width_target, &height_target, &nbChannels_target, 0);
+  unsigned char *source = NULL, *target = NULL;
+  {
+    Profiler::Scope scope("decode");
+    source = stbi_load(sourceImage.c_str(), &width, &height, &nbChannels, 0);
+    target = stbi_load(targetImage.c_str(), &width_target, &height_target, &nbChannels_target, 0);
+  }
+  if (!silent) std::cout<< "Source image: "<<width<<"x"<<height<<"   ("<<nbChannels<<")"<< std::endl;
   if (!silent) std::cout<< "Target image: "<<width_target<<"x"<<height_target<<"   ("<<nbChannels_target<<")"<< std::endl;
+  if (!silent) std::cout<< "SIMD kernels: "<<simdKernels().name<< std::endl;
   
   if ((width*height) > (width_target*height_target))
   {
@@ -135,54 +377,110 @@ int main(int argc, char **argv)
   
   std::vector<float> sourcefloat(width*height*nbChannels);
   std::vector<float> targetfloat(width*height*nbChannels);
-  for(auto i = 0 ; i <width*height*nbChannels; ++i)
   {
-    sourcefloat[i] = static_cast<float>(source[i]);
-    targetfloat[i] = static_cast<float>(target[i]);
+    Profiler::Scope scope("convert");
+    for(auto i = 0 ; i <width*height*nbChannels; ++i)
+    {
+      sourcefloat[i] = static_cast<float>(source[i]);
+      targetfloat[i] = static_cast<float>(target[i]);
+    }
   }
   
   //Main computation
-  slicedTransfer(sourcefloat, targetfloat, nbSteps);
-  
-  //Output
-  std::vector<unsigned char> output(width*height*nbChannels);
-  if (applyRegularization)
+  if (pyramidLevels > 0)
   {
-    //Regularization of the transport plan (optional)
-    // (bilateral filter of the difference)
-    if (!silent) std::cout<<"Applying regularization step"<<std::endl;
-    cimg_library::CImg<float> transport(width, height, 1, 3);
-    for(auto i=0; i<width*height; ++i)
+    auto start = std::chrono::system_clock::now();
+    std::vector<float> full;
+    if (pyramidCheck) full = sourcefloat;
+    pyramidTransfer(sourcefloat, source, width, height, nbChannels, target, width_target, height_target, nbChannels_target,
+                    pyramidLevels, latticeSize, nbSteps);
+    std::chrono::duration<double> pyramidSeconds = std::chrono::system_clock::now() - start;
+    std::cout << "pyramid elapsed time: " << pyramidSeconds.count() << "s\n";
+    
+    if (pyramidCheck)
     {
-      transport[i] = sourcefloat[3*i] - static_cast<float>(source[3*i]);
-      transport[i+ width*height] = sourcefloat[3*i+1] - static_cast<float>(source[3*i+1]);
-      transport[i+2*width*height] = sourcefloat[3*i+2] - static_cast<float>(source[3*i+2]);
-    }
-    transport.blur_bilateral(transport, sigmaXY,sigmaV);
-  
-    auto output2(output);
-    for(auto i = 0 ; i < width*height ; ++i)
-    {
-      output[3*i]   = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i  ]) + transport[i])));
-      output[3*i+1] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+1]) + transport[i+ width*height])));
-      output[3*i+2] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f, static_cast<float>(source[3*i+2]) + transport[i+ width*height*2])));
+      //Full resolution solve, for comparison (error on the clamped 8-bit values)
+      auto startFull = std::chrono::system_clock::now();
+      slicedTransfer(full, targetfloat, nbSteps);
+      std::chrono::duration<double> fullSeconds = std::chrono::system_clock::now() - startFull;
+      double mae = 0.0, rmse = 0.0, maxErr = 0.0;
+      for(auto i = 0; i < 3*width*height; ++i)
+      {
+        double a = std::min(255.0f, std::max(0.0f, sourcefloat[i]));
+        double b = std::min(255.0f, std::max(0.0f, full[i]));
+        mae += std::abs(a - b);
+        rmse += (a - b)*(a - b);
+        maxErr = std::max(maxErr, std::abs(a - b));
+      }
+      mae /= 3.0*width*height;
+      rmse = std::sqrt(rmse/(3.0*width*height));
+      std::cout << "full solve time: " << fullSeconds.count() << "s (x" << fullSeconds.count()/pyramidSeconds.count() << ")\n"
+      << "pyramid vs full solve: MAE " << mae << " RMSE " << rmse << " max " << maxErr << "\n";
     }
   }
   else
   {
-    for(auto i = 0 ; i < width*height*nbChannels ; ++i)
-      output[i] = static_cast<unsigned char>(  std::min(255.0f, std::max(0.0f,  sourcefloat[i])));
+    //Progressive export, with the same post-processing as the final output
+    auto exportProgress = [&](const std::vector<float> &result, const int k) {
+      Profiler::Scope scope("progressive");
+      std::vector<unsigned char> image;
+      toImage(result, source, width, height, nbChannels, applyRegularization, sigmaXY, sigmaV, regularizer, image);
+      //Written under a temporary name first, so that a reader never sees a partial file
+      const std::string name = progressiveName(outputImage, k);
+      const std::string partial = name + ".part";
+      if (!stbi_write_png(partial.c_str(), width, height, nbChannels, image.data(), nbChannels*width) ||
+          std::rename(partial.c_str(), name.c_str()))
+      {
+        std::cout<<"Error while exporting the intermediate image "<<name<<"."<<std::endl;
+        exit(1);
+      }
+      if (!silent) std::cout<<"Intermediate result: "<<name<<std::endl;
+    };
+    if (progressive > 0)
+      slicedTransfer(sourcefloat, targetfloat, nbSteps, progressive, exportProgress);
+    else
+      slicedTransfer(sourcefloat, targetfloat, nbSteps);
   }
   
+  //Output
+  if (applyRegularization && !silent) std::cout<<"Applying regularization step"<<std::endl;
+  std::vector<unsigned char> output;
+  toImage(sourcefloat, source, width, height, nbChannels, applyRegularization, sigmaXY, sigmaV, regularizer, output);
+  
   //Final export
   if (!silent) std::cout<<"Exporting.."<<std::endl;
-  int errcode = stbi_write_png(outputImage.c_str(), width, height, nbChannels, output.data(), nbChannels*width);
+  int errcode = 0;
+  {
+    Profiler::Scope scope("encode");
+    errcode = stbi_write_png(outputImage.c_str(), width, height, nbChannels, output.data(), nbChannels*width);
+  }
   if (!errcode)
   {
     std::cout<<"Error while exporting the resulting image."<<std::endl;
     exit(errcode);
   }
   
+  if (!profileJson.empty())
+  {
+    Profiler &profiler = Profiler::instance();
+    profiler.setInfo("tool", "colorTransferPartial");
+    profiler.setInfo("source", sourceImage);
+    profiler.setInfo("target", targetImage);
+    profiler.setInfo("pixels", width*height);
+    profiler.setInfo("nbsteps", nbSteps);
+    profiler.setInfo("threads", ThreadPool::instance().size());
+    profiler.setInfo("simd", simdKernels().name);
+    profiler.setInfo("sort", stdSort ? "std" : "radix");
+    profiler.setInfo("directions", directions);
+    profiler.setInfo("matcher", matcher);
+    profiler.setInfo("budget", timeBudget*1000.0);
+    if (!profiler.saveJson(profileJson))
+    {
+      std::cout<<"Error while exporting the profile."<<std::endl;
+      exit(1);
+    }
+  }
+  
   stbi_image_free(source);
   stbi_image_free(target);
   exit(0);
@@ -41,8 +41,21 @@
 #define cimg_display 0  
 #include "CImg.h"
 
+#include "UnbalancedSliced/ThreadPool.h"
+#include "UnbalancedSliced/RadixSort.h"
+#include "UnbalancedSliced/SimdKernels.h"
+#include "UnbalancedSliced/BilateralGrid.h"
+#include "UnbalancedSliced/Profiler.h"
+#include "UnbalancedSliced/Directions.h"
+
 //Global flag to silent verbose messages
 bool silent;
+//Global flag to use std::sort instead of the radix sort
+bool stdSort;
+//Global seed of the random slice directions
+uint64_t seed;
+//Global schedule of the slice directions
+DirectionSequence::Schedule schedule;
 
 typedef std::vector<double> Point;
 typedef std::vector<Point> PointSet;
@@ -77,7 +90,8 @@ void regularize(const PointSet &sourceOrig,
                 PointSet &source,
                 const std::vector<unsigned int> dims,
                 const double sigmaXY,
-                const double sigmaV)
+                const double sigmaV,
+                const bool useCImg)
 {
   
   unsigned int size = (int)sqrt(source.size());
@@ -87,7 +101,10 @@ void regularize(const PointSet &sourceOrig,
     cimg_library::CImg<double> transport(size, size, 1, 1);
     for(auto j=0; j<size*size; ++j)
       transport[j] = source[j][dims[i]] - sourceOrig[j][dims[i]];;
-    transport.blur_bilateral(transport, sigmaXY,sigmaV);
+    if (useCImg)
+      transport.blur_bilateral(transport, sigmaXY,sigmaV);
+    else
+      BilateralGrid::filterPlanar(transport.data(), size, size, 1, sigmaXY, sigmaV);
     
     for(auto j = 0 ; j < size*size ; ++j)
       source[j][dims[i]] = std::min(1.0, std::max(0.0, sourceOrig[j][dims[i]] + transport[j]));
@@ -110,21 +127,6 @@ void dumpPointset(const std::string &filename, PointSet &pset)
 }
 
 
-/// Dot product for specified dimensions
-/// @param a a point
-/// @param b a second point
-/// @param dims the dimensions (subspace for the dot product)
-/// @return the dot product
-double dot(const Point &a, const Point &dir, const std::vector<unsigned int> &dims)
-{
-  double res=0.0;
-  for (auto i = 0; i < dims.size(); ++i)
-    res+= a[ dims[i] ] * dir[ dims[i] ];
-  return res;
-}
-
-
-
 void slicedTransfer(PointSet &source,
                     const PointSet &target,
                     const std::vector<unsigned int> &dims,
@@ -133,17 +135,33 @@ void slicedTransfer(PointSet &source,
 {
   
   //Random generator init to draw random line directions
-  std::mt19937 gen;
-  gen.seed(10);
-  std::normal_distribution<double> dist{0.0,1.0};
-  std::uniform_real_distribution<double> unif(0.0,1.0);
+  //(the k-th direction only depends on the seed and k)
+  DirectionSequence directionSequence(dims.size(), seed, schedule);
   auto N = source.size();
   
   assert(source.size()==target.size());
   
-  //Advection vector
-  Point zero(source[0].size(), 0.0);
-  PointSet advect(N, zero);
+  //Planar copies of the transported dimensions (one array per dimension)
+  const int D = dims.size();
+  std::vector<double> sourcePlanar(D*N), targetPlanar(D*N);
+  std::vector<const double*> sourceChannels(D), targetChannels(D);
+  Profiler::Scope convertScope("convert");
+  for(auto k = 0; k < D; ++k)
+  {
+    for(auto i = 0; i < N; ++i)
+    {
+      sourcePlanar[k*N+i] = source[i][dims[k]];
+      targetPlanar[k*N+i] = target[i][dims[k]];
+    }
+    sourceChannels[k] = &sourcePlanar[k*N];
+    targetChannels[k] = &targetPlanar[k*N];
+  }
+  convertScope.stop();
+  
+  //Advection vector (planar)
+  std::vector<double> advect(D*N, 0.0);
+  std::vector<double> disp(N);
+  std::vector<double> dirPlanar(D);
   
   //To store the 1D projections
   std::vector<double> projsource(N);
@@ -156,6 +174,8 @@ void slicedTransfer(PointSet &source,
   //according to their projections
   auto lambdaProjSource = [&projsource](unsigned int a, unsigned int b) {return projsource[a] < projsource[b]; };
   auto lambdaProjTarget = [&projtarget](unsigned int a, unsigned int b) {return projtarget[a] < projtarget[b]; };
+  RadixSorter<double> sorter;
+  ThreadPool &pool = ThreadPool::instance();
   
   for(auto i=0; i <N ; ++i)
   {
@@ -169,21 +189,9 @@ void slicedTransfer(PointSet &source,
     {
       //Random direction
       Point directions( source[0].size() , 0.0 );
-      double norm=0.0;
-     
-      if (dims.size()==1)
-        directions[dims[0]] = unif(gen);
-      else
-      {
-        for(auto i = 0; i < dims.size(); ++i  )
-        {
-          directions[dims[i]] = dist(gen);
-          norm += directions[dims[i]] * directions[dims[i]];
-        }
-        norm = std::sqrt(norm);
-        for(auto i = 0; i < dims.size(); ++i  )
-          directions[dims[i]] /= norm;
-      }
+      directionSequence.next(dirPlanar.data());
+      for(auto i = 0; i < dims.size(); ++i  )
+        directions[dims[i]] = dirPlanar[i];
      
      if (!silent)
       {
@@ -193,35 +201,54 @@ void slicedTransfer(PointSet &source,
         std::cout << std::endl;
       }
       
+      Profiler::Scope sliceScope("slice", true);
+      
       //We project the points
       //1D optimal transport of the projections with two sorts
-      std::thread threadA([&]{for(auto i = 0; i < N; ++i)
-                                 projsource[i] = dot(source[i], directions, dims);
-                              std::sort(idSource.begin(), idSource.end(), lambdaProjSource); });
-      
-      //Parallel
-      for(auto i = 0; i <N; ++i)
-        projtarget[i] = dot(target[i], directions, dims);
-      std::sort(idTarget.begin(), idTarget.end(), lambdaProjTarget);
-      threadA.join();
-      
-      //We accumulate the displacements in a batch
-      for(auto p = 0; p < N; ++p)
+      Profiler::Scope projectionScope("projection");
+      pool.parallelFor(N, [&](size_t begin, size_t end) {
+        projectPlanar(sourceChannels.data(), dirPlanar.data(), D, begin, end, projsource.data());
+        projectPlanar(targetChannels.data(), dirPlanar.data(), D, begin, end, projtarget.data());
+      });
+      projectionScope.stop();
+      Profiler::Scope sortScope("sort");
+      if (stdSort)
       {
-        auto pix = idSource[p];
-        for(auto i = 0; i < dims.size(); ++i  )
-          advect[pix][dims[i]] += directions[dims[i]]  * (projtarget[idTarget[p]] - projsource[ pix ]);
+        auto taskA = pool.submit([&]{ std::sort(idSource.begin(), idSource.end(), lambdaProjSource); });
+        std::sort(idTarget.begin(), idTarget.end(), lambdaProjTarget);
+        taskA.wait();
       }
-    }
-    for(auto i = 0; i <N; ++i)
-    {
-      for(auto k=0; k < dims.size(); ++k)
+      else
       {
-        source[i][dims[k]] += advect[i][dims[k]]/(double)batchSize;
-        advect[i][dims[k]] = 0.0;
+        sorter.argsort(projsource.data(), idSource.data(), N);
+        sorter.argsort(projtarget.data(), idTarget.data(), N);
       }
+      sortScope.stop();
+      
+      //We accumulate the displacements in a batch
+      Profiler::Scope matchingScope("matching");
+      pool.parallelFor(N, [&](size_t begin, size_t end) {
+        for(auto p = begin; p < end; ++p)
+          disp[idSource[p]] = projtarget[idTarget[p]] - projsource[idSource[p]];
+      });
+      matchingScope.stop();
+      Profiler::Scope accumulationScope("accumulation");
+      pool.parallelFor(N, [&](size_t begin, size_t end) {
+        for(auto k = 0; k < D; ++k)
+          accumulateDisplacement(&advect[k*N], disp.data(), dirPlanar[k], begin, end);
+      });
     }
+    Profiler::Scope advectionScope("advection");
+    pool.parallelFor(D*N, [&](size_t begin, size_t end) {
+      advectPlanar(sourcePlanar.data(), advect.data(), 1.0, (double)batchSize, begin, end);
+      std::fill(advect.begin() + begin, advect.begin() + end, 0.0);
+    });
   }
+  
+  //Copyback
+  for(auto k = 0; k < D; ++k)
+    for(auto i = 0; i < N; ++i)
+      source[i][dims[k]] = sourcePlanar[k*N+i];
 }
 
 
@@ -246,29 +273,71 @@ int main(int argc, char **argv)
   app.add_option("--sigmaXY", sigmaXY, "Sigma parameter in the spatial domain for the bilateral regularization (16.0)");
   float sigmaV = 5.0;
   app.add_option("--sigmaV", sigmaV, "Sigma parameter in the value domain for the bilateral regularization (5.0)");
+  std::string regularizer = "cimg";
+  app.add_option("--regularizer", regularizer, "Bilateral filter of the regularization: grid (multi-threaded bilateral grid) or cimg (CImg::blur_bilateral) (cimg)")->check(CLI::IsMember({"grid", "cimg"}));
   silent = false;
   app.add_flag("--silent", silent, "No verbose messages");
+  stdSort = false;
+  app.add_flag("--stdsort", stdSort, "Use std::sort instead of the parallel radix sort for the 1D problems (false)");
+  seed = 10;
+  app.add_option("--seed", seed, "Seed of the random slice directions, the results do not depend on the number of threads (10)");
+  std::string directions = "gaussian";
+  app.add_option("--directions", directions, "Schedule of the slice directions: independent gaussian directions, random orthonormal bases or low-discrepancy (QMC) sequence (gaussian)")->check(CLI::IsMember({"gaussian", "orthobasis", "qmc"}));
+  unsigned int nbThreads = 0;
+  app.add_option("--threads", nbThreads, "Number of threads of the worker pool (0 = all cores)");
  
   
   std::vector<unsigned int> dimensions;
   app.add_option("--dims", dimensions, "OT subspace");
+  std::string profileJson;
+  app.add_option("--profile-json", profileJson, "Export the time spent in each phase (and per slice) to a JSON file");
   CLI11_PARSE(app, argc, argv);
+  schedule = DirectionSequence::scheduleFromName(directions);
   
+  ThreadPool::instance().resize(nbThreads);
+  Profiler::instance().enable(!profileJson.empty());
+  if (!silent) std::cout<<"SIMD kernels: "<<simdKernels().name<<std::endl;
  
   //Loading data
+  Profiler::Scope decodeScope("decode");
   PointSet source = loadPointset(sourceImage);
   PointSet orig = source;
   PointSet target = loadPointset(targetImage);
+  decodeScope.stop();
   
   slicedTransfer(source, target, dimensions, nbSteps, batchSize);
 
   if (applyRegularization)
   {
     if (!silent) std::cout<<"Applying regularization step"<<std::endl;
-    regularize(orig, source, dimensions, sigmaXY, sigmaV);
+    Profiler::Scope scope("regularization");
+    regularize(orig, source, dimensions, sigmaXY, sigmaV, regularizer == "cimg");
   }
   //export
+  Profiler::Scope encodeScope("encode");
   dumpPointset(outputImage, source);
+  encodeScope.stop();
+  
+  if (!profileJson.empty())
+  {
+    Profiler &profiler = Profiler::instance();
+    profiler.setInfo("tool", "ndTransfer");
+    profiler.setInfo("source", sourceImage);
+    profiler.setInfo("target", targetImage);
+    profiler.setInfo("points", source.size());
+    profiler.setInfo("dimensions", dimensions.size());
+    profiler.setInfo("nbsteps", nbSteps);
+    profiler.setInfo("batch", batchSize);
+    profiler.setInfo("threads", ThreadPool::instance().size());
+    profiler.setInfo("simd", simdKernels().name);
+    profiler.setInfo("sort", stdSort ? "std" : "radix");
+    profiler.setInfo("directions", directions);
+    if (!profiler.saveJson(profileJson))
+    {
+      std::cout<<"Error while exporting the profile."<<std::endl;
+      exit(1);
+    }
+  }
 
   exit(0);
 }
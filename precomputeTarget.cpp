@@ -0,0 +1,106 @@
+/*
+ Copyright (c) 2019 CNRS
+ David Coeurjolly <david.coeurjolly@liris.cnrs.fr>
+ 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ 1. Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIEDi
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+//Command-line parsing
+#include "CLI11.hpp"
+
+//Image I/O
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "UnbalancedSliced/ThreadPool.h"
+#include "UnbalancedSliced/TargetProjections.h"
+#include "UnbalancedSliced/TransferContext.h"
+
+//Precomputes the sorted projections of a target image along the first
+//directions drawn by colorTransfer, so that colorTransfer can skip the
+//target projection and sort (--target-proj option).
+int main(int argc, char **argv)
+{
+  CLI::App app{"precomputeTarget"};
+  std::string targetImage;
+  app.add_option("-t,--target", targetImage, "Target image")->required()->check(CLI::ExistingFile);
+  std::string outputFile;
+  app.add_option("-o,--output", outputFile, "Output projection file")->required();
+  unsigned int nbDirections = 3;
+  app.add_option("-k,--nbdirections", nbDirections, "Number of directions, must be at least nbsteps*sizeBatch of the colorTransfer runs (3)");
+  unsigned int nbQuantiles = 0;
+  app.add_option("--quantiles", nbQuantiles, "Only store this number of quantile knots per direction (0 = all the sorted projections)");
+  unsigned int nbThreads = 0;
+  app.add_option("--threads", nbThreads, "Number of threads of the worker pool (0 = all cores)");
+  uint64_t seed = 10;
+  app.add_option("--seed", seed, "Seed of the random directions, must be the one of the colorTransfer runs (10)");
+  std::string directions = "gaussian";
+  app.add_option("--directions", directions, "Schedule of the slice directions: independent gaussian directions, random orthonormal bases or low-discrepancy (QMC) sequence (gaussian)")->check(CLI::IsMember({"gaussian", "orthobasis", "qmc"}));
+  bool silent = false;
+  app.add_flag("--silent", silent, "No verbose messages");
+  CLI11_PARSE(app, argc, argv);
+  
+  ThreadPool &pool = ThreadPool::instance();
+  pool.resize(nbThreads);
+  
+  //Image loading
+  int width,height, nbChannels;
+  unsigned char *target = stbi_load(targetImage.c_str(), &width, &height, &nbChannels, 0);
+  if (!silent) std::cout<< "Target image: "<<width<<"x"<<height<<"   ("<<nbChannels<<")"<< std::endl;
+  if (nbChannels <3)
+  {
+    std::cout<< "Input images must be color images."<<std::endl;
+    exit(1);
+  }
+  
+  //Planar RGB
+  const size_t N = width*height;
+  std::vector<float> targetfloat(3*N);
+  for(auto k = 0; k < 3; ++k)
+    for(auto i = 0; i < N; ++i)
+      targetfloat[k*N+i] = static_cast<float>(target[nbChannels*i+k]);
+  const float *channels[3] = {&targetfloat[0], &targetfloat[N], &targetfloat[2*N]};
+  
+  auto start = std::chrono::system_clock::now();
+  
+  TargetProjections projections;
+  TransferContext context;
+  context.precomputeTarget(channels, N, nbDirections, nbQuantiles, projections, seed, DirectionSequence::scheduleFromName(directions));
+  
+  auto end = std::chrono::system_clock::now();
+  std::chrono::duration<double> elapsed_seconds = end - start;
+  if (!silent) std::cout << "elapsed time: " << elapsed_seconds.count() << "s\n";
+  
+  if (!projections.save(outputFile))
+  {
+    std::cout<<"Error while exporting the target projections."<<std::endl;
+    exit(1);
+  }
+  
+  stbi_image_free(target);
+  exit(0);
+}
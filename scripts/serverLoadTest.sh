@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Load test of the colorTransfer server mode.
+#
+# Sends JOBS transfer jobs with CONCURRENCY clients in parallel to a running server
+# (colorTransfer --server SOCKET --register ID=target.png) and reports the
+# throughput and the latency distribution of the jobs.
+#
+# Usage: serverLoadTest.sh -S socket -s source.png -t target_id [-j jobs] [-c concurrency]
+#                          [-C colorTransferClient] [-- extra client options]
+set -euo pipefail
+
+CLIENT=./colorTransferClient
+SOCKET=
+SOURCE=
+TARGET=
+JOBS=100
+CONCURRENCY=4
+
+usage() {
+  sed -n '2,9p' "$0" | sed 's/^# \{0,1\}//'
+  exit 1
+}
+
+while getopts "S:s:t:j:c:C:h" opt; do
+  case $opt in
+    S) SOCKET=$OPTARG ;;
+    s) SOURCE=$OPTARG ;;
+    t) TARGET=$OPTARG ;;
+    j) JOBS=$OPTARG ;;
+    c) CONCURRENCY=$OPTARG ;;
+    C) CLIENT=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+[ -n "$SOCKET" ] && [ -n "$SOURCE" ] && [ -n "$TARGET" ] || usage
+EXTRA=("$@")
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# One client process per job: the latency includes the connection and the transfer
+# of the result, as seen by a real caller
+run_job() {
+  "$CLIENT" -S "$SOCKET" -s "$SOURCE" -t "$TARGET" -o "$WORKDIR/out_$1.png" "${EXTRA[@]}" \
+    | sed -n 's/.*server_ms=\([0-9.e+-]*\) latency_ms=\([0-9.e+-]*\).*/\1 \2/p'
+  rm -f "$WORKDIR/out_$1.png"
+}
+export -f run_job
+export CLIENT SOCKET SOURCE TARGET WORKDIR
+export EXTRA_STR="${EXTRA[*]:-}"
+
+START=$(date +%s.%N)
+seq "$JOBS" | xargs -P "$CONCURRENCY" -I{} bash -c 'EXTRA=($EXTRA_STR); run_job {}' > "$WORKDIR/latencies.txt"
+END=$(date +%s.%N)
+
+DONE=$(wc -l < "$WORKDIR/latencies.txt")
+echo "jobs: $DONE/$JOBS completed, concurrency $CONCURRENCY"
+awk -v start="$START" -v end="$END" -v n="$DONE" 'BEGIN {
+  wall = end - start
+  printf "wall time: %.3f s, throughput: %.2f jobs/s\n", wall, (wall > 0) ? n / wall : 0
+}'
+sort -g -k2 "$WORKDIR/latencies.txt" | awk '
+  { server[NR] = $1; latency[NR] = $2; sumServer += $1; sumLatency += $2 }
+  function pct(p) { i = int(p * NR + 0.999999); if (i < 1) i = 1; if (i > NR) i = NR; return latency[i] }
+  END {
+    if (NR == 0) { print "no job completed"; exit 1 }
+    printf "latency (ms): mean %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", sumLatency / NR, pct(0.5), pct(0.9), pct(0.99), latency[NR]
+    printf "server time (ms): mean %.2f\n", sumServer / NR
+  }'
+[ "$DONE" -eq "$JOBS" ]